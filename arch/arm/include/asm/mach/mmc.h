@@ -130,6 +130,8 @@ struct mmc_platform_data {
 	unsigned int xpc_cap;
 	/* Supported UHS-I Modes */
 	unsigned int uhs_caps;
+	/* More host capabilities, MMC_CAP2_* */
+	u32 caps2;
 	void (*sdio_lpm_gpio_setup)(struct device *, unsigned int);
         unsigned int status_irq;
 	unsigned int status_gpio;
@@ -394,9 +394,39 @@ static int blk_init_free_list(struct request_queue *q)
 	if (!rl->rq_pool)
 		return -ENOMEM;
 
+	rl->rq_cache = alloc_percpu(struct blk_rq_cache);
+	if (!rl->rq_cache) {
+		mempool_destroy(rl->rq_pool);
+		rl->rq_pool = NULL;
+		return -ENOMEM;
+	}
+
 	return 0;
 }
 
+/*
+ * Give back the requests parked in the per-cpu caches, called from the
+ * queue release path before the mempool is destroyed.
+ */
+void blk_free_rq_cache(struct request_queue *q)
+{
+	struct request_list *rl = &q->rq;
+	int cpu;
+
+	if (!rl->rq_cache)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_rq_cache *cache = per_cpu_ptr(rl->rq_cache, cpu);
+
+		while (cache->nr)
+			mempool_free(cache->rqs[--cache->nr], rl->rq_pool);
+	}
+
+	free_percpu(rl->rq_cache);
+	rl->rq_cache = NULL;
+}
+
 struct request_queue *blk_alloc_queue(gfp_t gfp_mask)
 {
 	return blk_alloc_queue_node(gfp_mask, -1);
@@ -568,18 +598,66 @@ int blk_get_queue(struct request_queue *q)
 }
 EXPORT_SYMBOL(blk_get_queue);
 
+/*
+ * The per-cpu request cache is only touched by its own cpu, with
+ * interrupts off since requests are freed from completion context.
+ */
+static struct request *blk_rq_cache_get(struct request_list *rl)
+{
+	struct blk_rq_cache *cache;
+	struct request *rq = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(rl->rq_cache);
+	if (cache->nr)
+		rq = cache->rqs[--cache->nr];
+	local_irq_restore(flags);
+
+	return rq;
+}
+
+static void blk_rq_cache_put(struct request_list *rl, struct request *rq)
+{
+	struct blk_rq_cache *cache;
+	unsigned long flags;
+
+	/*
+	 * Refill the mempool reserve first, a task waiting in
+	 * mempool_alloc() must not starve while other cpus hold on to
+	 * requests.  The unlocked peek at curr_nr is only a hint.
+	 */
+	if (rl->rq_pool->curr_nr < rl->rq_pool->min_nr) {
+		mempool_free(rq, rl->rq_pool);
+		return;
+	}
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(rl->rq_cache);
+	if (cache->nr < BLK_RQ_CACHE_SIZE) {
+		cache->rqs[cache->nr++] = rq;
+		rq = NULL;
+	}
+	local_irq_restore(flags);
+
+	if (rq)
+		mempool_free(rq, rl->rq_pool);
+}
+
 static inline void blk_free_request(struct request_queue *q, struct request *rq)
 {
 	if (rq->cmd_flags & REQ_ELVPRIV)
 		elv_put_request(q, rq);
-	mempool_free(rq, q->rq.rq_pool);
+	blk_rq_cache_put(&q->rq, rq);
 }
 
 static struct request *
 blk_alloc_request(struct request_queue *q, int flags, int priv, gfp_t gfp_mask)
 {
-	struct request *rq = mempool_alloc(q->rq.rq_pool, gfp_mask);
+	struct request *rq = blk_rq_cache_get(&q->rq);
 
+	if (!rq)
+		rq = mempool_alloc(q->rq.rq_pool, gfp_mask);
 	if (!rq)
 		return NULL;
 
@@ -589,7 +667,7 @@ blk_alloc_request(struct request_queue *q, int flags, int priv, gfp_t gfp_mask)
 
 	if (priv) {
 		if (unlikely(elv_set_request(q, rq, gfp_mask))) {
-			mempool_free(rq, q->rq.rq_pool);
+			blk_rq_cache_put(&q->rq, rq);
 			return NULL;
 		}
 		rq->cmd_flags |= REQ_ELVPRIV;
@@ -1281,10 +1359,8 @@ get_rq:
 	init_request_from_bio(req, bio);
 
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
-	    bio_flagged(bio, BIO_CPU_AFFINE)) {
-		req->cpu = blk_cpu_to_group(get_cpu());
-		put_cpu();
-	}
+	    bio_flagged(bio, BIO_CPU_AFFINE))
+		req->cpu = raw_smp_processor_id();
 
 	plug = current->plug;
 	if (plug) {
@@ -1305,6 +1381,14 @@ get_rq:
 		}
 		list_add_tail(&req->queuelist, &plug->list);
 		drive_stat_acct(req, 1);
+
+		/*
+		 * Hand the staged requests to the driver in batches, so a
+		 * long plugged submission keeps the device busy instead of
+		 * building one huge list.
+		 */
+		if (++plug->count >= BLK_MAX_REQUEST_COUNT)
+			blk_flush_plug_list(plug, false);
 	} else {
 		spin_lock_irq(q->queue_lock);
 		add_acct_request(q, req, where);
@@ -2628,6 +2712,7 @@ void blk_start_plug(struct blk_plug *plug)
 	INIT_LIST_HEAD(&plug->list);
 	INIT_LIST_HEAD(&plug->cb_list);
 	plug->should_sort = 0;
+	plug->count = 0;
 
 	/*
 	 * If this is a nested plug, don't actually assign it. It will be
@@ -2711,6 +2796,7 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 		return;
 
 	list_splice_init(&plug->list, &list);
+	plug->count = 0;
 
 	if (plug->should_sort) {
 		list_sort(NULL, &list, plug_rq_cmp);
@@ -16,6 +16,7 @@ void blk_rq_bio_prep(struct request_queue *q, struct request *rq,
 int blk_rq_append_bio(struct request_queue *q, struct request *rq,
 		      struct bio *bio);
 void blk_dequeue_request(struct request *rq);
+void blk_free_rq_cache(struct request_queue *q);
 void __blk_queue_free_tags(struct request_queue *q);
 
 void blk_rq_timed_out_timer(unsigned long data);
@@ -0,0 +1,338 @@
+/*
+ *  ROW (Read Over Write) i/o scheduler.
+ *
+ *  A scheduler for flash based block devices.  There is no seek
+ *  penalty to optimise for, so requests are kept in per-class FIFOs
+ *  and dispatched by priority: reads first, then synchronous writes,
+ *  then background writeback, then idle class I/O.  Each class may
+ *  dispatch up to its quantum of requests per round, so lower classes
+ *  make progress under a steady stream of reads.  Nothing is held back
+ *  to wait for more I/O, the queue never idles.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/ioprio.h>
+#include <linux/iocontext.h>
+
+/*
+ * See Documentation/block/row-iosched.txt
+ */
+enum row_queue_prio {
+	ROWQ_READ = 0,		/* all reads */
+	ROWQ_SYNC_WRITE,	/* sync writes: fsync, O_SYNC, O_DIRECT */
+	ROWQ_ASYNC_WRITE,	/* background writeback */
+	ROWQ_LOW,		/* idle class reads and writes */
+	ROWQ_MAX,
+};
+
+/* default number of requests each queue may dispatch per round */
+static const int row_quantum[ROWQ_MAX] = {
+	[ROWQ_READ]		= 64,
+	[ROWQ_SYNC_WRITE]	= 16,
+	[ROWQ_ASYNC_WRITE]	= 4,
+	[ROWQ_LOW]		= 2,
+};
+
+struct row_queue {
+	struct list_head	fifo;
+	int			quantum;
+	int			nr_dispatched;	/* in the current round */
+};
+
+struct row_data {
+	struct row_queue	queues[ROWQ_MAX];
+};
+
+/*
+ * rq->elevator_private[0] is set for idle class requests when they are
+ * allocated, [1] holds the row_queue the request is queued on.
+ */
+#define RQ_LOW_PRIO(rq)		((rq)->elevator_private[0])
+#define RQ_ROWQ(rq)		((struct row_queue *) (rq)->elevator_private[1])
+
+static int row_prio_is_idle(unsigned short ioprio)
+{
+	struct io_context *ioc = current->io_context;
+	int class = IOPRIO_PRIO_CLASS(ioprio);
+
+	if (class == IOPRIO_CLASS_NONE && ioc)
+		class = IOPRIO_PRIO_CLASS(ioc->ioprio);
+
+	return class == IOPRIO_CLASS_IDLE;
+}
+
+static int row_set_request(struct request_queue *q, struct request *rq,
+			   gfp_t gfp_mask)
+{
+	RQ_LOW_PRIO(rq) = (void *) (unsigned long)
+				row_prio_is_idle(req_get_ioprio(rq));
+	return 0;
+}
+
+static enum row_queue_prio row_rq_prio(struct request *rq)
+{
+	if ((rq->cmd_flags & REQ_ELVPRIV) && RQ_LOW_PRIO(rq))
+		return ROWQ_LOW;
+	if (rq_data_dir(rq) == READ)
+		return ROWQ_READ;
+	if (rq_is_sync(rq))
+		return ROWQ_SYNC_WRITE;
+	return ROWQ_ASYNC_WRITE;
+}
+
+/*
+ * Only merge a bio into a request on the queue the bio would have been
+ * added to, so that e.g. a sync write does not wait behind writeback.
+ */
+static int row_allow_merge(struct request_queue *q, struct request *rq,
+			   struct bio *bio)
+{
+	enum row_queue_prio prio;
+
+	if (row_prio_is_idle(bio_prio(bio)))
+		prio = ROWQ_LOW;
+	else if (bio_data_dir(bio) == READ)
+		prio = ROWQ_READ;
+	else if (bio->bi_rw & REQ_SYNC)
+		prio = ROWQ_SYNC_WRITE;
+	else
+		prio = ROWQ_ASYNC_WRITE;
+
+	return prio == row_rq_prio(rq);
+}
+
+static void row_add_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = &rd->queues[row_rq_prio(rq)];
+
+	rq->elevator_private[1] = rqueue;
+	list_add_tail(&rq->queuelist, &rqueue->fifo);
+}
+
+static void row_merged_requests(struct request_queue *q, struct request *rq,
+				struct request *next)
+{
+	list_del_init(&next->queuelist);
+}
+
+static void row_dispatch_insert(struct request_queue *q,
+				struct row_queue *rqueue)
+{
+	struct request *rq;
+
+	rq = list_entry(rqueue->fifo.next, struct request, queuelist);
+	list_del_init(&rq->queuelist);
+	elv_dispatch_add_tail(q, rq);
+	rqueue->nr_dispatched++;
+}
+
+/*
+ * Pick the highest priority queue that has requests and quantum left in
+ * this round.  When every queue with requests has used up its quantum,
+ * a new round starts.
+ */
+static struct row_queue *row_select_queue(struct row_data *rd)
+{
+	struct row_queue *first = NULL;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX; i++) {
+		struct row_queue *rqueue = &rd->queues[i];
+
+		if (list_empty(&rqueue->fifo))
+			continue;
+		if (rqueue->nr_dispatched < rqueue->quantum)
+			return rqueue;
+		if (!first)
+			first = rqueue;
+	}
+
+	if (first) {
+		for (i = 0; i < ROWQ_MAX; i++)
+			rd->queues[i].nr_dispatched = 0;
+	}
+
+	return first;
+}
+
+static int row_dispatch_requests(struct request_queue *q, int force)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue;
+	int dispatched = 0;
+	int i;
+
+	if (unlikely(force)) {
+		for (i = 0; i < ROWQ_MAX; i++) {
+			rqueue = &rd->queues[i];
+			while (!list_empty(&rqueue->fifo)) {
+				row_dispatch_insert(q, rqueue);
+				dispatched++;
+			}
+			rqueue->nr_dispatched = 0;
+		}
+		return dispatched;
+	}
+
+	rqueue = row_select_queue(rd);
+	if (!rqueue)
+		return 0;
+
+	row_dispatch_insert(q, rqueue);
+	return 1;
+}
+
+static struct request *
+row_former_request(struct request_queue *q, struct request *rq)
+{
+	if (rq->queuelist.prev == &RQ_ROWQ(rq)->fifo)
+		return NULL;
+	return list_entry(rq->queuelist.prev, struct request, queuelist);
+}
+
+static struct request *
+row_latter_request(struct request_queue *q, struct request *rq)
+{
+	if (rq->queuelist.next == &RQ_ROWQ(rq)->fifo)
+		return NULL;
+	return list_entry(rq->queuelist.next, struct request, queuelist);
+}
+
+static void *row_init_queue(struct request_queue *q)
+{
+	struct row_data *rd;
+	int i;
+
+	rd = kmalloc_node(sizeof(*rd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!rd)
+		return NULL;
+
+	for (i = 0; i < ROWQ_MAX; i++) {
+		INIT_LIST_HEAD(&rd->queues[i].fifo);
+		rd->queues[i].quantum = row_quantum[i];
+	}
+	return rd;
+}
+
+static void row_exit_queue(struct elevator_queue *e)
+{
+	struct row_data *rd = e->elevator_data;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX; i++)
+		BUG_ON(!list_empty(&rd->queues[i].fifo));
+
+	kfree(rd);
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+row_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+row_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR)					\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	return row_var_show(__VAR, (page));				\
+}
+SHOW_FUNCTION(row_read_quantum_show, rd->queues[ROWQ_READ].quantum);
+SHOW_FUNCTION(row_sync_write_quantum_show,
+	      rd->queues[ROWQ_SYNC_WRITE].quantum);
+SHOW_FUNCTION(row_async_write_quantum_show,
+	      rd->queues[ROWQ_ASYNC_WRITE].quantum);
+SHOW_FUNCTION(row_low_prio_quantum_show, rd->queues[ROWQ_LOW].quantum);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)				\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page,	\
+		      size_t count)					\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	int __data;							\
+	int ret = row_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	*(__PTR) = __data;						\
+	return ret;							\
+}
+STORE_FUNCTION(row_read_quantum_store,
+	       &rd->queues[ROWQ_READ].quantum, 1, INT_MAX);
+STORE_FUNCTION(row_sync_write_quantum_store,
+	       &rd->queues[ROWQ_SYNC_WRITE].quantum, 1, INT_MAX);
+STORE_FUNCTION(row_async_write_quantum_store,
+	       &rd->queues[ROWQ_ASYNC_WRITE].quantum, 1, INT_MAX);
+STORE_FUNCTION(row_low_prio_quantum_store,
+	       &rd->queues[ROWQ_LOW].quantum, 1, INT_MAX);
+#undef STORE_FUNCTION
+
+#define ROW_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
+				      row_##name##_store)
+
+static struct elv_fs_entry row_attrs[] = {
+	ROW_ATTR(read_quantum),
+	ROW_ATTR(sync_write_quantum),
+	ROW_ATTR(async_write_quantum),
+	ROW_ATTR(low_prio_quantum),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_row = {
+	.ops = {
+		.elevator_merge_req_fn =	row_merged_requests,
+		.elevator_allow_merge_fn =	row_allow_merge,
+		.elevator_dispatch_fn =		row_dispatch_requests,
+		.elevator_add_req_fn =		row_add_request,
+		.elevator_former_req_fn =	row_former_request,
+		.elevator_latter_req_fn =	row_latter_request,
+		.elevator_set_req_fn =		row_set_request,
+		.elevator_init_fn =		row_init_queue,
+		.elevator_exit_fn =		row_exit_queue,
+	},
+
+	.elevator_attrs = row_attrs,
+	.elevator_name = "row",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init row_init(void)
+{
+	elv_register(&iosched_row);
+
+	return 0;
+}
+
+static void __exit row_exit(void)
+{
+	elv_unregister(&iosched_row);
+}
+
+module_init(row_init);
+module_exit(row_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("ROW (Read Over Write) IO scheduler");
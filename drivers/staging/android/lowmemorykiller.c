@@ -12,6 +12,10 @@
  * and kill processes with a oom_adj value of 0 or higher when the free memory
  * drops below 1024 pages.
  *
+ * With the memory controller, a cgroup can override the minfree levels for
+ * its own tasks through its memory.lmk_minfree file, e.g. to have
+ * background groups squeezed before foreground ones feel any pressure.
+ *
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
@@ -37,6 +41,7 @@
 #include <linux/notifier.h>
 #include <linux/memory.h>
 #include <linux/memory_hotplug.h>
+#include <linux/memcontrol.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -107,6 +112,23 @@ static int lmk_hotplug_callback(struct notifier_block *self,
 #endif
 
 
+static int lowmem_min_adj(size_t *minfree, int minfree_size,
+			  int other_free, int other_file)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+	int i;
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (minfree_size < array_size)
+		array_size = minfree_size;
+	for (i = 0; i < array_size; i++) {
+		if (other_free < minfree[i] &&
+		    other_file < minfree[i])
+			return lowmem_adj[i];
+	}
+	return OOM_ADJUST_MAX + 1;
+}
 
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
@@ -114,11 +136,11 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	struct task_struct *selected = NULL;
 	int rem = 0;
 	int tasksize;
-	int i;
-	int min_adj = OOM_ADJUST_MAX + 1;
+	int min_adj;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	bool memcg_lmk = mem_cgroup_lmk_enabled();
+	size_t memcg_minfree[MEM_CGROUP_LMK_LEVELS];
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
@@ -147,17 +169,8 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
-	}
+	min_adj = lowmem_min_adj(lowmem_minfree, lowmem_minfree_size,
+				 other_free, other_file);
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
@@ -166,7 +179,9 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
 		global_page_state(NR_INACTIVE_FILE);
-	if (sc->nr_to_scan <= 0 || min_adj == OOM_ADJUST_MAX + 1) {
+	/* groups with their own minfree levels may still have victims */
+	if (sc->nr_to_scan <= 0 ||
+	    (min_adj == OOM_ADJUST_MAX + 1 && !memcg_lmk)) {
 		lowmem_print(5, "lowmem_shrink %lu, %x, return %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
@@ -178,6 +193,17 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		struct mm_struct *mm;
 		struct signal_struct *sig;
 		int oom_adj;
+		int task_min_adj = min_adj;
+		int n;
+
+		if (memcg_lmk) {
+			n = mem_cgroup_lmk_minfree(p, memcg_minfree,
+						   ARRAY_SIZE(memcg_minfree));
+			if (n)
+				task_min_adj = lowmem_min_adj(memcg_minfree, n,
+							      other_free,
+							      other_file);
+		}
 
 		task_lock(p);
 		mm = p->mm;
@@ -187,7 +213,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			continue;
 		}
 		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+		if (oom_adj < task_min_adj) {
 			task_unlock(p);
 			continue;
 		}
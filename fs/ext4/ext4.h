@@ -818,6 +818,15 @@ struct ext4_inode_info {
 	 * by other means, so we have i_data_sem.
 	 */
 	struct rw_semaphore i_data_sem;
+
+	/*
+	 * i_dir_sem protects the layout of a directory with the pdirops
+	 * mount option, where i_mutex is not held across create and
+	 * unlink.  Those take it shared and lock only the leaf block they
+	 * change (ext4_dirblock_mutex()); anything that adds blocks,
+	 * splits a leaf or rewrites the index takes it exclusive.
+	 */
+	struct rw_semaphore i_dir_sem;
 	struct inode vfs_inode;
 	struct jbd2_inode *jinode;
 
@@ -866,6 +875,9 @@ struct ext4_inode_info {
 	 */
 	tid_t i_sync_tid;
 	tid_t i_datasync_tid;
+
+	/* Transaction that fsync can't fast commit, see fast_commit.c */
+	tid_t i_fc_ineligible_tid;
 };
 
 /*
@@ -917,6 +929,9 @@ struct ext4_inode_info {
 #define EXT4_MOUNT_DISCARD		0x40000000 /* Issue DISCARD requests */
 #define EXT4_MOUNT_INIT_INODE_TABLE	0x80000000 /* Initialize uninitialized itables */
 
+#define EXT4_MOUNT2_FAST_COMMIT		0x00000001 /* Fast commits for fsync */
+#define EXT4_MOUNT2_PDIROPS		0x00000002 /* Parallel create/unlink */
+
 #define clear_opt(sb, opt)		EXT4_SB(sb)->s_mount_opt &= \
 						~EXT4_MOUNT_##opt
 #define set_opt(sb, opt)		EXT4_SB(sb)->s_mount_opt |= \
@@ -1215,6 +1230,10 @@ struct ext4_sb_info {
 
 	/* Kernel thread for multiple mount protection */
 	struct task_struct *s_mmp_tsk;
+
+	/* Transaction no inode can be fast committed in */
+	tid_t s_fc_ineligible_tid;
+	int s_fc_ineligible;
 };
 
 static inline struct ext4_sb_info *EXT4_SB(struct super_block *sb)
@@ -1254,6 +1273,7 @@ enum {
 	EXT4_STATE_DIO_UNWRITTEN,	/* need convert on dio done*/
 	EXT4_STATE_NEWENTRY,		/* File just added to dir */
 	EXT4_STATE_DELALLOC_RESERVED,	/* blks already reserved for delalloc */
+	EXT4_STATE_FC_INELIGIBLE,	/* i_fc_ineligible_tid is valid */
 };
 
 #define EXT4_INODE_BIT_FNS(name, field, offset)				\
@@ -1762,6 +1782,12 @@ extern void ext4_htree_free_dir_info(struct dir_private_info *p);
 extern int ext4_sync_file(struct file *, int);
 extern int ext4_flush_completed_IO(struct inode *);
 
+/* fast_commit.c */
+extern void ext4_fc_mark_ineligible(handle_t *, struct super_block *,
+				    struct inode *);
+extern int ext4_fc_commit(struct inode *, tid_t);
+extern int ext4_fc_replay(journal_t *, const void *, unsigned int);
+
 /* hash.c */
 extern int ext4fs_dirhash(const char *name, int len, struct
 			  dx_hash_info *hinfo);
@@ -2231,6 +2257,12 @@ static inline void set_bitmap_uptodate(struct buffer_head *bh)
 extern wait_queue_head_t ext4__ioend_wq[EXT4_WQ_HASH_SZ];
 extern struct mutex ext4__aio_mutex[EXT4_WQ_HASH_SZ];
 
+/* For directory leaf blocks changed under a shared i_dir_sem */
+#define EXT4_DIRBLOCK_HASH_SZ	127
+#define ext4_dirblock_mutex(bh)	(&ext4__dirblock_mutex[		\
+		((unsigned long)(bh)->b_blocknr) % EXT4_DIRBLOCK_HASH_SZ])
+extern struct mutex ext4__dirblock_mutex[EXT4_DIRBLOCK_HASH_SZ];
+
 #endif	/* __KERNEL__ */
 
 #endif	/* _EXT4_H */
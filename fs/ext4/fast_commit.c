@@ -0,0 +1,240 @@
+/*
+ * linux/fs/ext4/fast_commit.c
+ *
+ * Fast commits for fsync.
+ *
+ * fsync normally commits the whole running transaction.  When all the
+ * file needs on disk is its inode and the blocks its extents point to,
+ * the inode is logged on its own instead: a copy of the raw on-disk
+ * inode goes into a jbd2 fast commit block (see jbd2_fc_commit()).  If
+ * the transaction never commits, recovery writes the copy back to the
+ * inode table and marks the blocks of its extents in use.
+ *
+ * That is only enough when the inode's extents all live in the inode
+ * and nothing else the inode depends on changed in the transaction:
+ * directory entries, freed blocks, extent index blocks, external xattr
+ * blocks, quota, or uninitialised block groups.  The paths making such
+ * changes mark the inode, or the whole filesystem, ineligible for the
+ * transaction and fsync falls back to a full commit.
+ */
+
+#include <linux/fs.h>
+#include <linux/jbd2.h>
+#include <linux/slab.h>
+#include <linux/quotaops.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "ext4_extents.h"
+
+/* Fast commit payload: the inode number, then the raw inode */
+struct ext4_fc_inode {
+	__le32	fc_ino;
+	__le16	fc_isize;
+	__le16	fc_reserved;
+};
+
+/*
+ * The transaction of @handle changes something a fast commit of @inode
+ * would not record; with a NULL @inode no inode may be fast committed
+ * in it.
+ */
+void ext4_fc_mark_ineligible(handle_t *handle, struct super_block *sb,
+			     struct inode *inode)
+{
+	tid_t tid;
+
+	if (!ext4_handle_valid(handle) || !test_opt2(sb, FAST_COMMIT))
+		return;
+
+	tid = handle->h_transaction->t_tid;
+	if (inode) {
+		EXT4_I(inode)->i_fc_ineligible_tid = tid;
+		ext4_set_inode_state(inode, EXT4_STATE_FC_INELIGIBLE);
+	} else {
+		EXT4_SB(sb)->s_fc_ineligible_tid = tid;
+		EXT4_SB(sb)->s_fc_ineligible = 1;
+	}
+}
+
+/*
+ * Log @inode for transaction @commit_tid without committing it.
+ * Returns 0 when the inode is on stable storage, any error means the
+ * caller has to commit the transaction.
+ */
+int ext4_fc_commit(struct inode *inode, tid_t commit_tid)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	int isize = EXT4_INODE_SIZE(sb);
+	struct ext4_fc_inode *fc;
+	struct ext4_iloc iloc;
+	int err;
+
+	if (!S_ISREG(inode->i_mode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) ||
+	    sb_any_quota_loaded(sb))
+		return -EOPNOTSUPP;
+	if (ext4_test_inode_state(inode, EXT4_STATE_FC_INELIGIBLE) &&
+	    !tid_gt(commit_tid, ei->i_fc_ineligible_tid))
+		return -EAGAIN;
+	if (sbi->s_fc_ineligible &&
+	    !tid_gt(commit_tid, sbi->s_fc_ineligible_tid))
+		return -EAGAIN;
+
+	fc = kmalloc(sizeof(*fc) + isize, GFP_NOFS);
+	if (!fc)
+		return -ENOMEM;
+
+	err = ext4_get_inode_loc(inode, &iloc);
+	if (err)
+		goto out;
+
+	down_read(&ei->i_data_sem);
+	if (ext_depth(inode)) {
+		err = -EAGAIN;
+	} else {
+		fc->fc_ino = cpu_to_le32(inode->i_ino);
+		fc->fc_isize = cpu_to_le16(isize);
+		fc->fc_reserved = 0;
+		memcpy(fc + 1, ext4_raw_inode(&iloc), isize);
+	}
+	up_read(&ei->i_data_sem);
+	brelse(iloc.bh);
+
+	if (!err)
+		err = jbd2_fc_commit(sbi->s_journal, commit_tid, fc,
+				     sizeof(*fc) + isize);
+ out:
+	kfree(fc);
+	return err;
+}
+
+/* Mark @count blocks from @block in use, they may span groups */
+static int ext4_fc_replay_blocks(struct super_block *sb, ext4_fsblk_t block,
+				 unsigned int count)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	while (count) {
+		struct ext4_group_desc *gdp;
+		struct buffer_head *gd_bh, *bitmap_bh;
+		ext4_group_t group;
+		ext4_grpblk_t offset;
+		unsigned int i, len, newly = 0;
+
+		ext4_get_group_no_and_offset(sb, block, &group, &offset);
+		len = min_t(unsigned int, count,
+			    EXT4_BLOCKS_PER_GROUP(sb) - offset);
+
+		gdp = ext4_get_group_desc(sb, group, &gd_bh);
+		if (!gdp)
+			return -EIO;
+		if (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT)) {
+			ext4_warning(sb, "fast commit uses blocks of "
+				     "uninitialised group %u", group);
+			goto next;
+		}
+
+		bitmap_bh = sb_bread(sb, ext4_block_bitmap(sb, gdp));
+		if (!bitmap_bh)
+			return -EIO;
+		lock_buffer(bitmap_bh);
+		for (i = 0; i < len; i++)
+			if (!ext4_set_bit(offset + i, bitmap_bh->b_data))
+				newly++;
+		unlock_buffer(bitmap_bh);
+		mark_buffer_dirty(bitmap_bh);
+		brelse(bitmap_bh);
+
+		if (newly) {
+			ext4_free_blks_set(sb, gdp,
+					   ext4_free_blks_count(sb, gdp) - newly);
+			gdp->bg_checksum = ext4_group_desc_csum(sbi, group, gdp);
+			mark_buffer_dirty(gd_bh);
+			if (sbi->s_log_groups_per_flex)
+				atomic_sub(newly, &sbi->s_flex_groups[
+					ext4_flex_group(sbi, group)].free_blocks);
+		}
+ next:
+		block += len;
+		count -= len;
+	}
+	return 0;
+}
+
+/*
+ * j_fc_replay callback, called by jbd2 recovery for each fast commit
+ * of the transaction that did not commit, oldest first.
+ */
+int ext4_fc_replay(journal_t *journal, const void *data, unsigned int len)
+{
+	struct super_block *sb = journal->j_private;
+	const struct ext4_fc_inode *fc = data;
+	struct ext4_inode *raw_inode;
+	struct ext4_extent_header *eh;
+	struct ext4_extent *ex;
+	struct ext4_group_desc *gdp;
+	struct buffer_head *bh;
+	unsigned long ino;
+	int isize = EXT4_INODE_SIZE(sb);
+	int inodes_per_block, inode_offset, i, err = 0;
+	ext4_fsblk_t block;
+
+	if (len < sizeof(*fc) || le16_to_cpu(fc->fc_isize) != isize ||
+	    len != sizeof(*fc) + isize)
+		goto corrupt;
+	ino = le32_to_cpu(fc->fc_ino);
+	if (!ext4_valid_inum(sb, ino))
+		goto corrupt;
+
+	raw_inode = (struct ext4_inode *) (fc + 1);
+	if (!(le32_to_cpu(raw_inode->i_flags) & EXT4_EXTENTS_FL))
+		goto corrupt;
+	eh = (struct ext4_extent_header *) raw_inode->i_block;
+	if (eh->eh_magic != EXT4_EXT_MAGIC || eh->eh_depth != 0 ||
+	    le16_to_cpu(eh->eh_entries) > le16_to_cpu(eh->eh_max) ||
+	    le16_to_cpu(eh->eh_max) > (sizeof(raw_inode->i_block) -
+				       sizeof(*eh)) / sizeof(*ex))
+		goto corrupt;
+
+	/* Copy the inode back into its inode table block */
+	gdp = ext4_get_group_desc(sb, (ino - 1) / EXT4_INODES_PER_GROUP(sb),
+				  NULL);
+	if (!gdp)
+		return -EIO;
+	inodes_per_block = EXT4_SB(sb)->s_inodes_per_block;
+	inode_offset = (ino - 1) % EXT4_INODES_PER_GROUP(sb);
+	block = ext4_inode_table(sb, gdp) + inode_offset / inodes_per_block;
+	bh = sb_bread(sb, block);
+	if (!bh)
+		return -EIO;
+	lock_buffer(bh);
+	memcpy(bh->b_data + (inode_offset % inodes_per_block) * isize,
+	       raw_inode, isize);
+	unlock_buffer(bh);
+	mark_buffer_dirty(bh);
+	brelse(bh);
+
+	/* Blocks allocated in the lost transaction */
+	ex = EXT_FIRST_EXTENT(eh);
+	for (i = 0; i < le16_to_cpu(eh->eh_entries); i++, ex++) {
+		ext4_fsblk_t start = ext4_ext_pblock(ex);
+		unsigned int count = ext4_ext_get_actual_len(ex);
+
+		if (start < le32_to_cpu(EXT4_SB(sb)->s_es->s_first_data_block) ||
+		    start + count > ext4_blocks_count(EXT4_SB(sb)->s_es)) {
+			ext4_warning(sb, "fast commit of inode %lu has bad "
+				     "extent %llu/%u", ino, start, count);
+			continue;
+		}
+		err = ext4_fc_replay_blocks(sb, start, count);
+		if (err)
+			break;
+	}
+	return err;
+
+ corrupt:
+	ext4_warning(sb, "corrupt fast commit record");
+	return -EIO;
+}
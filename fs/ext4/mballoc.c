@@ -2796,6 +2796,7 @@ ext4_mb_mark_diskspace_used(struct ext4_allocation_context *ac,
 		ext4_free_blks_set(sb, gdp,
 					ext4_free_blocks_after_init(sb,
 					ac->ac_b_ex.fe_group, gdp));
+		ext4_fc_mark_ineligible(handle, sb, NULL);
 	}
 	len = ext4_free_blks_count(sb, gdp) - ac->ac_b_ex.fe_len;
 	ext4_free_blks_set(sb, gdp, len);
@@ -4512,6 +4513,16 @@ void ext4_free_blocks(handle_t *handle, struct inode *inode,
 	if (!ext4_should_writeback_data(inode))
 		flags |= EXT4_FREE_BLOCKS_METADATA;
 
+	/*
+	 * Replaying a fast commit can't free blocks.  Blocks that are not
+	 * held back until the commit may be handed to another inode in
+	 * this very transaction, whose fast commit must not be used either.
+	 */
+	if (flags & EXT4_FREE_BLOCKS_METADATA)
+		ext4_fc_mark_ineligible(handle, sb, inode);
+	else
+		ext4_fc_mark_ineligible(handle, sb, NULL);
+
 do_more:
 	overflow = 0;
 	ext4_get_group_no_and_offset(sb, block, &block_group, &bit);
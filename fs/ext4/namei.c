@@ -49,6 +49,49 @@
 #define NAMEI_RA_SIZE	     (NAMEI_RA_CHUNKS * NAMEI_RA_BLOCKS)
 #define NAMEI_RA_INDEX(c,b)  (((c) * NAMEI_RA_BLOCKS) + (b))
 
+/*
+ * Directories of a pdirops mount are not under i_mutex while entries
+ * are added and removed, see i_dir_sem in ext4.h.  For all others
+ * i_mutex already serialises everything and these do nothing.
+ */
+static inline void ext4_dir_lock_shared(struct inode *dir)
+{
+	if (IS_PDIROPS(dir))
+		down_read(&EXT4_I(dir)->i_dir_sem);
+}
+
+static inline void ext4_dir_unlock_shared(struct inode *dir)
+{
+	if (IS_PDIROPS(dir))
+		up_read(&EXT4_I(dir)->i_dir_sem);
+}
+
+static inline void ext4_dir_lock_excl(struct inode *dir, int subclass)
+{
+	if (IS_PDIROPS(dir))
+		down_write_nested(&EXT4_I(dir)->i_dir_sem, subclass);
+}
+
+static inline void ext4_dir_unlock_excl(struct inode *dir)
+{
+	if (IS_PDIROPS(dir))
+		up_write(&EXT4_I(dir)->i_dir_sem);
+}
+
+static inline void ext4_dirblock_lock(struct inode *dir,
+				      struct buffer_head *bh)
+{
+	if (IS_PDIROPS(dir))
+		mutex_lock(ext4_dirblock_mutex(bh));
+}
+
+static inline void ext4_dirblock_unlock(struct inode *dir,
+					struct buffer_head *bh)
+{
+	if (IS_PDIROPS(dir))
+		mutex_unlock(ext4_dirblock_mutex(bh));
+}
+
 static struct buffer_head *ext4_append(handle_t *handle,
 					struct inode *inode,
 					ext4_lblk_t *block, int *err)
@@ -811,7 +854,9 @@ static inline int search_dirblock(struct buffer_head *bh,
 	int de_len;
 	const char *name = d_name->name;
 	int namelen = d_name->len;
+	int ret = 0;
 
+	ext4_dirblock_lock(dir, bh);
 	de = (struct ext4_dir_entry_2 *) bh->b_data;
 	dlimit = bh->b_data + dir->i_sb->s_blocksize;
 	while ((char *) de < dlimit) {
@@ -821,20 +866,26 @@ static inline int search_dirblock(struct buffer_head *bh,
 		if ((char *) de + namelen <= dlimit &&
 		    ext4_match (namelen, name, de)) {
 			/* found a match - just to be sure, do a full check */
-			if (ext4_check_dir_entry(dir, NULL, de, bh, offset))
-				return -1;
+			if (ext4_check_dir_entry(dir, NULL, de, bh, offset)) {
+				ret = -1;
+				break;
+			}
 			*res_dir = de;
-			return 1;
+			ret = 1;
+			break;
 		}
 		/* prevent looping on a bad block */
 		de_len = ext4_rec_len_from_disk(de->rec_len,
 						dir->i_sb->s_blocksize);
-		if (de_len <= 0)
-			return -1;
+		if (de_len <= 0) {
+			ret = -1;
+			break;
+		}
 		offset += de_len;
 		de = (struct ext4_dir_entry_2 *) ((char *) de + de_len);
 	}
-	return 0;
+	ext4_dirblock_unlock(dir, bh);
+	return ret;
 }
 
 
@@ -1027,11 +1078,13 @@ static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, stru
 	if (dentry->d_name.len > EXT4_NAME_LEN)
 		return ERR_PTR(-ENAMETOOLONG);
 
+	ext4_dir_lock_shared(dir);
 	bh = ext4_find_entry(dir, &dentry->d_name, &de);
 	inode = NULL;
 	if (bh) {
 		__u32 ino = le32_to_cpu(de->inode);
 		brelse(bh);
+		ext4_dir_unlock_shared(dir);
 		if (!ext4_valid_inum(dir->i_sb, ino)) {
 			EXT4_ERROR_INODE(dir, "bad inode number: %u", ino);
 			return ERR_PTR(-EIO);
@@ -1047,7 +1100,8 @@ static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, stru
 				return ERR_CAST(inode);
 			}
 		}
-	}
+	} else
+		ext4_dir_unlock_shared(dir);
 	return d_splice_alias(inode, dentry);
 }
 
@@ -1062,11 +1116,15 @@ struct dentry *ext4_get_parent(struct dentry *child)
 	struct ext4_dir_entry_2 * de;
 	struct buffer_head *bh;
 
+	ext4_dir_lock_shared(child->d_inode);
 	bh = ext4_find_entry(child->d_inode, &dotdot, &de);
+	if (bh) {
+		ino = le32_to_cpu(de->inode);
+		brelse(bh);
+	}
+	ext4_dir_unlock_shared(child->d_inode);
 	if (!bh)
 		return ERR_PTR(-ENOENT);
-	ino = le32_to_cpu(de->inode);
-	brelse(bh);
 
 	if (!ext4_valid_inum(child->d_inode->i_sb, ino)) {
 		EXT4_ERROR_INODE(child->d_inode,
@@ -1440,13 +1498,14 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
  *
  * adds a file entry to the specified directory, using the same
  * semantics as ext4_find_entry(). It returns NULL if it failed.
+ * __ext4_add_entry() is called with i_dir_sem held exclusive.
  *
  * NOTE!! The inode part of 'de' is left at 0 - which means you
  * may not sleep between calling this and putting something into
  * the entry, as someone else might have used it while you slept.
  */
-static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
-			  struct inode *inode)
+static int __ext4_add_entry(handle_t *handle, struct dentry *dentry,
+			    struct inode *inode)
 {
 	struct inode *dir = dentry->d_parent->d_inode;
 	struct buffer_head *bh;
@@ -1498,6 +1557,57 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	return retval;
 }
 
+/*
+ * Add an entry to the htree leaf it hashes to, with i_dir_sem held
+ * shared.  Returns -EAGAIN when that needs the directory exclusive:
+ * the leaf is full, or the index is bad.
+ */
+static int ext4_dx_add_entry_shared(handle_t *handle, struct dentry *dentry,
+				    struct inode *inode)
+{
+	struct dx_frame frames[2], *frame;
+	struct dx_hash_info hinfo;
+	struct buffer_head *bh;
+	struct inode *dir = dentry->d_parent->d_inode;
+	int err;
+
+	frame = dx_probe(&dentry->d_name, dir, &hinfo, frames, &err);
+	if (!frame)
+		return err == ERR_BAD_DX_DIR ? -EAGAIN : err;
+	bh = ext4_bread(handle, dir, dx_get_block(frame->at), 0, &err);
+	dx_release(frames);
+	if (!bh)
+		return err;
+
+	ext4_dirblock_lock(dir, bh);
+	err = add_dirent_to_buf(handle, dentry, inode, NULL, bh);
+	ext4_dirblock_unlock(dir, bh);
+	brelse(bh);
+	return err == -ENOSPC ? -EAGAIN : err;
+}
+
+static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
+			  struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	int retval;
+
+	if (IS_PDIROPS(dir) && is_dx(dir) && dentry->d_name.len) {
+		ext4_dir_lock_shared(dir);
+		retval = -EAGAIN;
+		if (is_dx(dir))
+			retval = ext4_dx_add_entry_shared(handle, dentry, inode);
+		ext4_dir_unlock_shared(dir);
+		if (retval != -EAGAIN)
+			return retval;
+	}
+
+	ext4_dir_lock_excl(dir, 0);
+	retval = __ext4_add_entry(handle, dentry, inode);
+	ext4_dir_unlock_excl(dir);
+	return retval;
+}
+
 /*
  * Returns 0 for success, or a negative error value
  */
@@ -1647,20 +1757,23 @@ static int ext4_delete_entry(handle_t *handle,
 {
 	struct ext4_dir_entry_2 *de, *pde;
 	unsigned int blocksize = dir->i_sb->s_blocksize;
-	int i, err;
+	int i, err = -ENOENT;
 
+	ext4_dirblock_lock(dir, bh);
 	i = 0;
 	pde = NULL;
 	de = (struct ext4_dir_entry_2 *) bh->b_data;
 	while (i < bh->b_size) {
-		if (ext4_check_dir_entry(dir, NULL, de, bh, i))
-			return -EIO;
+		if (ext4_check_dir_entry(dir, NULL, de, bh, i)) {
+			err = -EIO;
+			break;
+		}
 		if (de == de_del)  {
 			BUFFER_TRACE(bh, "get_write_access");
 			err = ext4_journal_get_write_access(handle, bh);
 			if (unlikely(err)) {
 				ext4_std_error(dir->i_sb, err);
-				return err;
+				break;
 			}
 			if (pde)
 				pde->rec_len = ext4_rec_len_to_disk(
@@ -1674,17 +1787,16 @@ static int ext4_delete_entry(handle_t *handle,
 			dir->i_version++;
 			BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
 			err = ext4_handle_dirty_metadata(handle, dir, bh);
-			if (unlikely(err)) {
+			if (unlikely(err))
 				ext4_std_error(dir->i_sb, err);
-				return err;
-			}
-			return 0;
+			break;
 		}
 		i += ext4_rec_len_from_disk(de->rec_len, blocksize);
 		pde = de;
 		de = ext4_next_entry(de, blocksize);
 	}
-	return -ENOENT;
+	ext4_dirblock_unlock(dir, bh);
+	return err;
 }
 
 /*
@@ -1985,6 +2097,7 @@ int ext4_orphan_add(handle_t *handle, struct inode *inode)
 	if (!ext4_handle_valid(handle))
 		return 0;
 
+	ext4_fc_mark_ineligible(handle, sb, inode);
 	mutex_lock(&EXT4_SB(sb)->s_orphan_lock);
 	if (!list_empty(&EXT4_I(inode)->i_orphan))
 		goto out_unlock;
@@ -2067,6 +2180,8 @@ int ext4_orphan_del(handle_t *handle, struct inode *inode)
 	if (handle && !ext4_handle_valid(handle))
 		return 0;
 
+	if (handle)
+		ext4_fc_mark_ineligible(handle, inode->i_sb, inode);
 	mutex_lock(&EXT4_SB(inode->i_sb)->s_orphan_lock);
 	if (list_empty(&ei->i_orphan))
 		goto out;
@@ -2145,9 +2260,10 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 		return PTR_ERR(handle);
 
 	retval = -ENOENT;
+	ext4_dir_lock_shared(dir);
 	bh = ext4_find_entry(dir, &dentry->d_name, &de);
 	if (!bh)
-		goto end_rmdir;
+		goto end_rmdir_unlock;
 
 	if (IS_DIRSYNC(dir))
 		ext4_handle_sync(handle);
@@ -2156,13 +2272,14 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 
 	retval = -EIO;
 	if (le32_to_cpu(de->inode) != inode->i_ino)
-		goto end_rmdir;
+		goto end_rmdir_unlock;
 
 	retval = -ENOTEMPTY;
 	if (!empty_dir(inode))
-		goto end_rmdir;
+		goto end_rmdir_unlock;
 
 	retval = ext4_delete_entry(handle, dir, de, bh);
+	ext4_dir_unlock_shared(dir);
 	if (retval)
 		goto end_rmdir;
 	if (!EXT4_DIR_LINK_EMPTY(inode))
@@ -2181,7 +2298,10 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 	ext4_dec_count(handle, dir);
 	ext4_update_dx_flag(dir);
 	ext4_mark_inode_dirty(handle, dir);
+	goto end_rmdir;
 
+end_rmdir_unlock:
+	ext4_dir_unlock_shared(dir);
 end_rmdir:
 	ext4_journal_stop(handle);
 	brelse(bh);
@@ -2210,15 +2330,16 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 		ext4_handle_sync(handle);
 
 	retval = -ENOENT;
+	ext4_dir_lock_shared(dir);
 	bh = ext4_find_entry(dir, &dentry->d_name, &de);
 	if (!bh)
-		goto end_unlink;
+		goto end_unlink_unlock;
 
 	inode = dentry->d_inode;
 
 	retval = -EIO;
 	if (le32_to_cpu(de->inode) != inode->i_ino)
-		goto end_unlink;
+		goto end_unlink_unlock;
 
 	if (!inode->i_nlink) {
 		ext4_warning(inode->i_sb,
@@ -2227,8 +2348,10 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 		inode->i_nlink = 1;
 	}
 	retval = ext4_delete_entry(handle, dir, de, bh);
+	ext4_dir_unlock_shared(dir);
 	if (retval)
 		goto end_unlink;
+	ext4_fc_mark_ineligible(handle, inode->i_sb, inode);
 	dir->i_ctime = dir->i_mtime = ext4_current_time(dir);
 	ext4_update_dx_flag(dir);
 	ext4_mark_inode_dirty(handle, dir);
@@ -2238,7 +2361,10 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	inode->i_ctime = ext4_current_time(inode);
 	ext4_mark_inode_dirty(handle, inode);
 	retval = 0;
+	goto end_unlink;
 
+end_unlink_unlock:
+	ext4_dir_unlock_shared(dir);
 end_unlink:
 	ext4_journal_stop(handle);
 	brelse(bh);
@@ -2376,6 +2502,7 @@ retry:
 
 	inode->i_ctime = ext4_current_time(inode);
 	ext4_inc_count(handle, inode);
+	ext4_fc_mark_ineligible(handle, inode->i_sb, inode);
 	ihold(inode);
 
 	err = ext4_add_entry(handle, dentry, inode);
@@ -2399,6 +2526,31 @@ retry:
  * Anybody can rename anything with this: the permission checks are left to the
  * higher-level routines.
  */
+/*
+ * Rename may split leaves of both directories and rewrites ".." of the
+ * directory it moves, so all of them are locked exclusive.  Renames
+ * between directories are serialised by s_vfs_rename_mutex.
+ */
+static void ext4_rename_lock(struct inode *old_dir, struct inode *new_dir,
+			     struct inode *old_inode)
+{
+	ext4_dir_lock_excl(old_dir, 0);
+	if (new_dir != old_dir)
+		ext4_dir_lock_excl(new_dir, 1);
+	if (S_ISDIR(old_inode->i_mode))
+		ext4_dir_lock_excl(old_inode, 2);
+}
+
+static void ext4_rename_unlock(struct inode *old_dir, struct inode *new_dir,
+			       struct inode *old_inode)
+{
+	if (S_ISDIR(old_inode->i_mode))
+		ext4_dir_unlock_excl(old_inode);
+	if (new_dir != old_dir)
+		ext4_dir_unlock_excl(new_dir);
+	ext4_dir_unlock_excl(old_dir);
+}
+
 static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 		       struct inode *new_dir, struct dentry *new_dentry)
 {
@@ -2426,6 +2578,12 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	if (IS_DIRSYNC(old_dir) || IS_DIRSYNC(new_dir))
 		ext4_handle_sync(handle);
 
+	ext4_fc_mark_ineligible(handle, old_dir->i_sb, old_dentry->d_inode);
+	if (new_dentry->d_inode)
+		ext4_fc_mark_ineligible(handle, new_dir->i_sb,
+					new_dentry->d_inode);
+
+	ext4_rename_lock(old_dir, new_dir, old_dentry->d_inode);
 	old_bh = ext4_find_entry(old_dir, &old_dentry->d_name, &old_de);
 	/*
 	 *  Check for inode number is _not_ due to possible IO errors.
@@ -2469,7 +2627,7 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 			goto end_rename;
 	}
 	if (!new_bh) {
-		retval = ext4_add_entry(handle, new_dentry, old_inode);
+		retval = __ext4_add_entry(handle, new_dentry, old_inode);
 		if (retval)
 			goto end_rename;
 	} else {
@@ -2567,6 +2725,7 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 	retval = 0;
 
 end_rename:
+	ext4_rename_unlock(old_dir, new_dir, old_dentry->d_inode);
 	brelse(dir_bh);
 	brelse(old_bh);
 	brelse(new_bh);
@@ -765,6 +765,9 @@ static void ext4_put_super(struct super_block *sb)
 		ext4_commit_super(sb, 1);
 
 	if (sbi->s_journal) {
+		/* The log is empty after this, older kernels can mount it */
+		jbd2_journal_clear_features(sbi->s_journal, 0, 0,
+				JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
 		err = jbd2_journal_destroy(sbi->s_journal);
 		sbi->s_journal = NULL;
 		if (err < 0)
@@ -913,6 +916,7 @@ static void init_once(void *foo)
 	init_rwsem(&ei->xattr_sem);
 #endif
 	init_rwsem(&ei->i_data_sem);
+	init_rwsem(&ei->i_dir_sem);
 	inode_init_once(&ei->vfs_inode);
 }
 
@@ -1068,6 +1072,10 @@ static int ext4_show_options(struct seq_file *seq, struct vfsmount *vfs)
 		seq_puts(seq, ",journal_async_commit");
 	else if (test_opt(sb, JOURNAL_CHECKSUM))
 		seq_puts(seq, ",journal_checksum");
+	if (test_opt2(sb, FAST_COMMIT))
+		seq_puts(seq, ",fast_commit");
+	if (test_opt2(sb, PDIROPS))
+		seq_puts(seq, ",pdirops");
 	if (test_opt(sb, I_VERSION))
 		seq_puts(seq, ",i_version");
 	if (!test_opt(sb, DELALLOC) &&
@@ -1292,7 +1300,8 @@ enum {
 	Opt_inode_readahead_blks, Opt_journal_ioprio,
 	Opt_dioread_nolock, Opt_dioread_lock,
 	Opt_discard, Opt_nodiscard,
-	Opt_init_inode_table, Opt_noinit_inode_table,
+	Opt_init_inode_table, Opt_noinit_inode_table, Opt_fast_commit,
+	Opt_pdirops,
 };
 
 static const match_table_t tokens = {
@@ -1368,6 +1377,8 @@ static const match_table_t tokens = {
 	{Opt_init_inode_table, "init_itable=%u"},
 	{Opt_init_inode_table, "init_itable"},
 	{Opt_noinit_inode_table, "noinit_itable"},
+	{Opt_fast_commit, "fast_commit"},
+	{Opt_pdirops, "pdirops"},
 	{Opt_err, NULL},
 };
 
@@ -1858,6 +1869,18 @@ set_qf_format:
 		case Opt_noinit_inode_table:
 			clear_opt(sb, INIT_INODE_TABLE);
 			break;
+		case Opt_fast_commit:
+			set_opt2(sb, FAST_COMMIT);
+			break;
+		case Opt_pdirops:
+			/* Inodes already in core would keep i_mutex */
+			if (is_remount && !test_opt2(sb, PDIROPS)) {
+				ext4_msg(sb, KERN_ERR,
+					 "Cannot enable pdirops on remount");
+				return 0;
+			}
+			set_opt2(sb, PDIROPS);
+			break;
 		default:
 			ext4_msg(sb, KERN_ERR,
 			       "Unrecognized mount option \"%s\" "
@@ -3545,6 +3568,17 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 				JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT);
 	}
 
+	if (test_opt2(sb, FAST_COMMIT) &&
+	    !jbd2_journal_set_features(sbi->s_journal, 0, 0,
+				       JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		ext4_msg(sb, KERN_WARNING, "journal does not support "
+			 "fast commits, disabling fast_commit");
+		clear_opt2(sb, FAST_COMMIT);
+	}
+	if (!test_opt2(sb, FAST_COMMIT))
+		jbd2_journal_clear_features(sbi->s_journal, 0, 0,
+				JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+
 	/* We have now updated the journal if required, so we can
 	 * validate the data journaling mode. */
 	switch (test_opt(sb, DATA_FLAGS)) {
@@ -3996,6 +4030,9 @@ static int ext4_load_journal(struct super_block *sb,
 		}
 	}
 
+	/* Fast commits are replayed whether or not fast_commit is set */
+	journal->j_fc_replay = ext4_fc_replay;
+
 	if (!EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_RECOVER))
 		err = jbd2_journal_wipe(journal, !really_read_only);
 	if (!err) {
@@ -4935,6 +4972,7 @@ static void ext4_exit_feat_adverts(void)
 /* Shared across all ext4 file systems */
 wait_queue_head_t ext4__ioend_wq[EXT4_WQ_HASH_SZ];
 struct mutex ext4__aio_mutex[EXT4_WQ_HASH_SZ];
+struct mutex ext4__dirblock_mutex[EXT4_DIRBLOCK_HASH_SZ];
 
 static int __init ext4_init_fs(void)
 {
@@ -4946,6 +4984,8 @@ static int __init ext4_init_fs(void)
 		mutex_init(&ext4__aio_mutex[i]);
 		init_waitqueue_head(&ext4__ioend_wq[i]);
 	}
+	for (i = 0; i < EXT4_DIRBLOCK_HASH_SZ; i++)
+		mutex_init(&ext4__dirblock_mutex[i]);
 
 	err = ext4_init_pageio();
 	if (err)
@@ -490,14 +490,19 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
 	INIT_LIST_HEAD(&cc->list);
 	cc->fc.release = cuse_fc_release;
 
+	/* the channel takes over the base reference to cc */
+	rc = fuse_chan_install(&cc->fc, file);
+	fuse_conn_put(&cc->fc);
+	if (rc)
+		return rc;
+
 	cc->fc.connected = 1;
 	cc->fc.blocked = 0;
 	rc = cuse_send_init(cc);
 	if (rc) {
-		fuse_conn_put(&cc->fc);
+		fuse_dev_release(inode, file);
 		return rc;
 	}
-	file->private_data = &cc->fc;	/* channel owns base reference to cc */
 
 	return 0;
 }
@@ -515,7 +520,8 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
  */
 static int cuse_channel_release(struct inode *inode, struct file *file)
 {
-	struct cuse_conn *cc = fc_to_cc(file->private_data);
+	struct fuse_chan *chan = file->private_data;
+	struct cuse_conn *cc = fc_to_cc(chan->fc);
 	int rc;
 
 	/* remove from the conntbl, no more access from this point on */
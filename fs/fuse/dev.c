@@ -26,11 +26,12 @@ MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_chan *fuse_get_chan(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or clone and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
@@ -209,6 +210,10 @@ void fuse_put_request(struct fuse_conn *fc, struct fuse_req *req)
 		if (req->waiting)
 			atomic_dec(&fc->num_waiting);
 
+		/* Backing file from an open reply nobody took */
+		if (req->passthrough_filp)
+			fput(req->passthrough_filp);
+
 		if (req->stolen_file)
 			put_reserved_req(fc, req);
 		else
@@ -238,18 +243,52 @@ static u64 fuse_get_unique(struct fuse_conn *fc)
 	return fc->reqctr;
 }
 
+/*
+ * Pick the channel for a new request by the submitting CPU.  A daemon
+ * that reads each channel from its own thread thus doesn't have all
+ * threads contending on one queue.  With more channels than CPUs the
+ * extra ones only get requests by taking them from the others, see
+ * fuse_pending_chan().
+ */
+static struct fuse_chan *fuse_route_chan(struct fuse_conn *fc)
+{
+	return fc->chans[raw_smp_processor_id() % fc->nr_chans];
+}
+
+/*
+ * Wake a reader for new work on @chan.  When all readers of @chan are
+ * busy, wake an idle reader of another channel instead, it will take
+ * the request from @chan rather than leave it waiting.
+ */
+static void fuse_chan_wake(struct fuse_conn *fc, struct fuse_chan *chan)
+{
+	unsigned i;
+
+	if (!waitqueue_active(&chan->waitq)) {
+		for (i = 0; i < fc->nr_chans; i++) {
+			if (waitqueue_active(&fc->chans[i]->waitq)) {
+				chan = fc->chans[i];
+				break;
+			}
+		}
+	}
+	wake_up(&chan->waitq);
+	kill_fasync(&chan->fasync, SIGIO, POLL_IN);
+}
+
 static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_chan *chan = fuse_route_chan(fc);
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	list_add_tail(&req->list, &chan->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	fuse_chan_wake(fc, chan);
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
@@ -262,8 +301,7 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 	if (fc->connected) {
 		fc->forget_list_tail->next = forget;
 		fc->forget_list_tail = forget;
-		wake_up(&fc->waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+		fuse_chan_wake(fc, fuse_route_chan(fc));
 	} else {
 		kfree(forget);
 	}
@@ -336,11 +374,14 @@ __acquires(fc->lock)
 	spin_lock(&fc->lock);
 }
 
+/* The interrupt goes to the channel the request was read from */
 static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	struct fuse_chan *chan = req->chan;
+
+	list_add_tail(&req->intr_entry, &chan->interrupts);
+	wake_up(&chan->waitq);
+	kill_fasync(&chan->fasync, SIGIO, POLL_IN);
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
@@ -915,21 +956,42 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+/*
+ * The channel to read the next request from: @chan itself, or any other
+ * channel with pending requests, so that a reader with nothing to do
+ * takes over requests queued behind a busy one.
+ */
+static struct fuse_chan *fuse_pending_chan(struct fuse_chan *chan)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	struct fuse_conn *fc = chan->fc;
+	unsigned i;
+
+	if (!list_empty(&chan->pending))
+		return chan;
+
+	for (i = 0; i < fc->nr_chans; i++) {
+		if (!list_empty(&fc->chans[i]->pending))
+			return fc->chans[i];
+	}
+	return NULL;
+}
+
+static int request_pending(struct fuse_chan *chan)
+{
+	return !list_empty(&chan->interrupts) || forget_pending(chan->fc) ||
+		fuse_pending_chan(chan);
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
+static void request_wait(struct fuse_chan *chan)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	struct fuse_conn *fc = chan->fc;
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&chan->waitq, &wait);
+	while (fc->connected && !request_pending(chan)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
@@ -939,7 +1001,7 @@ __acquires(fc->lock)
 		spin_lock(&fc->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&chan->waitq, &wait);
 }
 
 /*
@@ -1103,9 +1165,11 @@ __releases(fc->lock)
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_chan *chan, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = chan->fc;
+	struct fuse_chan *src;
 	int err;
 	struct fuse_req *req;
 	struct fuse_in *in;
@@ -1115,34 +1179,36 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 	spin_lock(&fc->lock);
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	    !request_pending(chan))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(chan);
 	err = -ENODEV;
 	if (!fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(chan))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&chan->interrupts)) {
+		req = list_entry(chan->interrupts.next, struct fuse_req,
 				 intr_entry);
 		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
+	src = fuse_pending_chan(chan);
 	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
+		if (!src || fc->forget_batch-- > 0)
 			return fuse_read_forget(fc, cs, nbytes);
 
 		if (fc->forget_batch <= -8)
 			fc->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	/* The reply comes back on this channel, the request moves to it */
+	req = list_entry(src->pending.next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &chan->io);
 
 	in = &req->in;
 	reqsize = in->h.len;
@@ -1177,7 +1243,8 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		req->chan = chan;
+		list_move_tail(&req->list, &chan->processing);
 		if (req->interrupted)
 			queue_interrupt(fc, req);
 		spin_unlock(&fc->lock);
@@ -1194,13 +1261,13 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(file);
+	if (!chan)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 1, iov, nr_segs);
+	fuse_copy_init(&cs, chan->fc, 1, iov, nr_segs);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_read(chan, file, &cs, iov_length(iov, nr_segs));
 }
 
 static int fuse_dev_pipe_buf_steal(struct pipe_inode_info *pipe,
@@ -1228,18 +1295,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(in);
+	if (!chan)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL, 0);
+	fuse_copy_init(&cs, chan->fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(chan, in, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -1607,11 +1674,11 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find(struct fuse_chan *chan, u64 unique)
 {
 	struct list_head *entry;
 
-	list_for_each(entry, &fc->processing) {
+	list_for_each(entry, &chan->processing) {
 		struct fuse_req *req;
 		req = list_entry(entry, struct fuse_req, list);
 		if (req->in.h.unique == unique || req->intr_unique == unique)
@@ -1650,9 +1717,10 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
  * it from the list and copy the rest of the buffer to the request.
  * The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+static ssize_t fuse_dev_do_write(struct fuse_chan *chan,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = chan->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
@@ -1686,7 +1754,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (!fc->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(chan, oh.unique);
 	if (!req)
 		goto err_unlock;
 
@@ -1714,7 +1782,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	}
 
 	req->state = FUSE_REQ_WRITING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &chan->io);
 	req->out.h = oh;
 	req->locked = 1;
 	cs->req = req;
@@ -1724,6 +1792,8 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 
 	err = copy_out_args(cs, &req->out, nbytes);
 	fuse_copy_finish(cs);
+	if (!err)
+		fuse_passthrough_setup(fc, req);
 
 	spin_lock(&fc->lock);
 	req->locked = 0;
@@ -1747,13 +1817,13 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(iocb->ki_filp);
+	if (!chan)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 0, iov, nr_segs);
+	fuse_copy_init(&cs, chan->fc, 0, iov, nr_segs);
 
-	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_write(chan, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1764,12 +1834,12 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	unsigned idx;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc;
+	struct fuse_chan *chan;
 	size_t rem;
 	ssize_t ret;
 
-	fc = fuse_get_conn(out);
-	if (!fc)
+	chan = fuse_get_chan(out);
+	if (!chan)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
@@ -1816,14 +1886,14 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	}
 	pipe_unlock(pipe);
 
-	fuse_copy_init(&cs, fc, 0, NULL, nbuf);
+	fuse_copy_init(&cs, chan->fc, 0, NULL, nbuf);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
 
 	if (flags & SPLICE_F_MOVE)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(chan, &cs, len);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -1837,16 +1907,18 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(file);
+	struct fuse_conn *fc;
+	if (!chan)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	fc = chan->fc;
+	poll_wait(file, &chan->waitq, wait);
 
 	spin_lock(&fc->lock);
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(chan))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fc->lock);
 
@@ -1886,9 +1958,15 @@ static void end_io_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
-	while (!list_empty(&fc->io)) {
+	LIST_HEAD(io);
+	unsigned i;
+
+	for (i = 0; i < fc->nr_chans; i++)
+		list_splice_init(&fc->chans[i]->io, &io);
+
+	while (!list_empty(&io)) {
 		struct fuse_req *req =
-			list_entry(fc->io.next, struct fuse_req, list);
+			list_entry(io.next, struct fuse_req, list);
 		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
 
 		req->aborted = 1;
@@ -1908,14 +1986,24 @@ __acquires(fc->lock)
 	}
 }
 
+/*
+ * The requests of all channels are collected on a private list first,
+ * a channel may go away while fc->lock is dropped in end_requests().
+ */
 static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	LIST_HEAD(queued);
+	unsigned i;
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
+	for (i = 0; i < fc->nr_chans; i++) {
+		list_splice_tail_init(&fc->chans[i]->pending, &queued);
+		list_splice_tail_init(&fc->chans[i]->processing, &queued);
+	}
+	end_requests(fc, &queued);
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
 }
@@ -1963,25 +2051,98 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		end_io_requests(fc);
 		end_queued_requests(fc);
 		end_polls(fc);
-		wake_up_all(&fc->waitq);
+		fuse_chans_wake_all(fc);
 		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	}
 	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+void fuse_chans_wake_all(struct fuse_conn *fc)
+{
+	unsigned i;
+
+	for (i = 0; i < fc->nr_chans; i++) {
+		wake_up_all(&fc->chans[i]->waitq);
+		kill_fasync(&fc->chans[i]->fasync, SIGIO, POLL_IN);
+	}
+}
+
+int fuse_chan_install(struct fuse_conn *fc, struct file *file)
+{
+	struct fuse_chan *chan;
+
+	chan = kzalloc(sizeof(*chan), GFP_KERNEL);
+	if (!chan)
+		return -ENOMEM;
+
+	chan->fc = fuse_conn_get(fc);
+	init_waitqueue_head(&chan->waitq);
+	INIT_LIST_HEAD(&chan->pending);
+	INIT_LIST_HEAD(&chan->processing);
+	INIT_LIST_HEAD(&chan->io);
+	INIT_LIST_HEAD(&chan->interrupts);
+
+	spin_lock(&fc->lock);
+	if (fc->nr_chans == FUSE_MAX_CHANS) {
+		spin_unlock(&fc->lock);
+		fuse_conn_put(fc);
+		kfree(chan);
+		return -EBUSY;
+	}
+	chan->idx = fc->nr_chans;
+	fc->chans[fc->nr_chans++] = chan;
+	spin_unlock(&fc->lock);
+
+	file->private_data = chan;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(fuse_chan_install);
+
+/*
+ * Unlink the channel.  Requests not yet read are moved to another
+ * channel, those already read can't be answered any more and are
+ * aborted.
+ *
+ * This function releases and reacquires fc->lock
+ */
+static void fuse_chan_remove(struct fuse_chan *chan)
+__releases(fc->lock)
+__acquires(fc->lock)
+{
+	struct fuse_conn *fc = chan->fc;
+	struct fuse_chan *last = fc->chans[--fc->nr_chans];
+
+	fc->chans[chan->idx] = last;
+	last->idx = chan->idx;
+	fc->chans[fc->nr_chans] = NULL;
+
+	if (fc->nr_chans && !list_empty(&chan->pending)) {
+		list_splice_tail_init(&chan->pending, &fc->chans[0]->pending);
+		wake_up(&fc->chans[0]->waitq);
+		kill_fasync(&fc->chans[0]->fasync, SIGIO, POLL_IN);
+	}
+	end_requests(fc, &chan->processing);
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	struct fuse_chan *chan = fuse_get_chan(file);
+	if (chan) {
+		struct fuse_conn *fc = chan->fc;
+
 		spin_lock(&fc->lock);
-		fc->connected = 0;
-		fc->blocked = 0;
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->blocked_waitq);
+		if (fc->nr_chans == 1) {
+			fc->connected = 0;
+			fc->blocked = 0;
+			end_queued_requests(fc);
+			end_polls(fc);
+			wake_up_all(&fc->blocked_waitq);
+		}
+		fuse_chan_remove(chan);
 		spin_unlock(&fc->lock);
+		kfree(chan);
 		fuse_conn_put(fc);
 	}
 
@@ -1991,12 +2152,60 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *chan = fuse_get_chan(file);
+	if (!chan)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &chan->fasync);
+}
+
+/*
+ * Attach an unused /dev/fuse file to the connection of another one as
+ * a new channel
+ */
+static int fuse_dev_clone(struct file *file, unsigned oldfd)
+{
+	struct file *old;
+	struct fuse_chan *chan;
+	int err;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EINVAL;
+
+	mutex_lock(&fuse_mutex);
+	err = -EINVAL;
+	chan = fuse_get_chan(old);
+	if (old->f_op != file->f_op || !chan || file->private_data)
+		goto out_unlock;
+
+	err = -ENODEV;
+	if (!chan->fc->connected)
+		goto out_unlock;
+
+	err = fuse_chan_install(chan->fc, file);
+
+ out_unlock:
+	mutex_unlock(&fuse_mutex);
+	fput(old);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	u32 oldfd;
+
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		if (get_user(oldfd, (u32 __user *) arg))
+			return -EFAULT;
+		return fuse_dev_clone(file, oldfd);
+
+	default:
+		return -ENOTTY;
+	}
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -2011,6 +2220,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -23,6 +23,8 @@
 #include <linux/poll.h>
 #include <linux/workqueue.h>
 
+#define FUSE_SUPER_MAGIC 0x65735546
+
 /** Max number of pages that can be used in a single read request */
 #define FUSE_MAX_PAGES_PER_REQ 32
 
@@ -32,6 +34,9 @@
 /** It could be as large as PATH_MAX, but would that have any uses? */
 #define FUSE_NAME_MAX 1024
 
+/** Maximum number of device channels of a connection */
+#define FUSE_MAX_CHANS 32
+
 /** Number of dentries for each connection in the control filesystem */
 #define FUSE_CTL_NUM_DENTRIES 5
 
@@ -135,6 +140,9 @@ struct fuse_file {
 
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
+
+	/** Backing file for passthrough read/write/mmap, or NULL */
+	struct file *passthrough_filp;
 };
 
 /** One input argument of a request */
@@ -307,6 +315,47 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** Backing file from an open reply, until taken by the fuse_file */
+	struct file *passthrough_filp;
+
+	/** Channel the request was read from */
+	struct fuse_chan *chan;
+};
+
+/**
+ * A device channel.  Each /dev/fuse file descriptor of a connection,
+ * the one passed at mount and any cloned from it, has its own request
+ * queues and wait queue.  New requests are queued on the channel
+ * picked by the submitting CPU, but an idle reader takes pending
+ * requests from any channel.  A reply must be written to the
+ * channel the request was read from.  All fields are protected by
+ * fc->lock.
+ */
+struct fuse_chan {
+	/** The connection */
+	struct fuse_conn *fc;
+
+	/** Index in fc->chans */
+	unsigned idx;
+
+	/** Idle readers of the channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** The list of requests being processed */
+	struct list_head processing;
+
+	/** The list of requests under I/O */
+	struct list_head io;
+
+	/** Pending interrupts for requests on the processing list */
+	struct list_head interrupts;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
 };
 
 /**
@@ -341,17 +390,11 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
+	/** Device channels, requests are spread over these */
+	struct fuse_chan *chans[FUSE_MAX_CHANS];
 
-	/** The list of pending requests */
-	struct list_head pending;
-
-	/** The list of requests being processed */
-	struct list_head processing;
-
-	/** The list of requests under I/O */
-	struct list_head io;
+	/** Number of entries in chans */
+	unsigned nr_chans;
 
 	/** The next unique kernel file handle */
 	u64 khctr;
@@ -374,9 +417,6 @@ struct fuse_conn {
 	/** The list of background requests set aside for later queuing */
 	struct list_head bg_queue;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
-
 	/** Queue of pending forgets */
 	struct fuse_forget_link forget_list_head;
 	struct fuse_forget_link *forget_list_tail;
@@ -472,6 +512,12 @@ struct fuse_conn {
 	/** Don't apply umask to creation modes */
 	unsigned dont_mask:1;
 
+	/** Cache buffered writes in the page cache, see fuse_writepages() */
+	unsigned writeback_cache:1;
+
+	/** Open may hand over a backing file, see passthrough.c */
+	unsigned passthrough:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -493,9 +539,6 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
-
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
 
@@ -683,6 +726,16 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 /* Abort all requests */
 void fuse_abort_conn(struct fuse_conn *fc);
 
+/**
+ * Attach a new channel of the connection to a /dev/fuse file
+ */
+int fuse_chan_install(struct fuse_conn *fc, struct file *file);
+
+/**
+ * Wake up readers of all channels, called with fc->lock held
+ */
+void fuse_chans_wake_all(struct fuse_conn *fc);
+
 /**
  * Invalidate inode attributes
  */
@@ -763,4 +816,14 @@ int fuse_dev_release(struct inode *inode, struct file *file);
 
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
+/* passthrough.c */
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_req *req);
+void fuse_passthrough_take(struct fuse_file *ff, struct fuse_req *req);
+void fuse_passthrough_release(struct fuse_file *ff);
+ssize_t fuse_passthrough_read(struct kiocb *iocb, const struct iovec *iov,
+			      unsigned long nr_segs, loff_t pos);
+ssize_t fuse_passthrough_write(struct kiocb *iocb, const struct iovec *iov,
+			       unsigned long nr_segs, loff_t pos);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
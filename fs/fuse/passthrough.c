@@ -0,0 +1,223 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2008  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+/*
+ * Passthrough: the reply to OPEN or CREATE may carry the descriptor of
+ * a file the daemon has opened on a lower filesystem.  Reads, writes
+ * and mmap of the fuse file are then served by that file directly,
+ * without a round trip through the daemon.  Lookup, open, permission
+ * checks and all other operations still go to userspace.
+ */
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/cred.h>
+#include <linux/uio.h>
+#include <linux/pagemap.h>
+#include <linux/fsnotify.h>
+
+/*
+ * Called from fuse_dev_do_write() in the context of the daemon, after
+ * the reply arguments have been copied but before the request is
+ * ended.  The descriptor must be resolved here, it means nothing in
+ * the context of the process doing the open.
+ */
+void fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_open_out *outarg;
+	struct file *lower;
+	struct inode *inode;
+
+	if (!fc->passthrough || req->out.h.error)
+		return;
+	if (req->in.h.opcode != FUSE_OPEN && req->in.h.opcode != FUSE_CREATE)
+		return;
+
+	outarg = req->out.args[req->out.numargs - 1].value;
+	if (!(outarg->open_flags & FOPEN_PASSTHROUGH))
+		return;
+	outarg->open_flags &= ~FOPEN_PASSTHROUGH;
+
+	lower = fget(outarg->passthrough_fd);
+	if (!lower)
+		return;
+
+	inode = lower->f_dentry->d_inode;
+	if (!S_ISREG(inode->i_mode) || !lower->f_op ||
+	    !lower->f_op->aio_read || !lower->f_op->aio_write ||
+	    inode->i_sb->s_magic == FUSE_SUPER_MAGIC) {
+		fput(lower);
+		return;
+	}
+
+	req->passthrough_filp = lower;
+}
+
+void fuse_passthrough_take(struct fuse_file *ff, struct fuse_req *req)
+{
+	ff->passthrough_filp = req->passthrough_filp;
+	req->passthrough_filp = NULL;
+}
+
+void fuse_passthrough_release(struct fuse_file *ff)
+{
+	if (ff->passthrough_filp) {
+		fput(ff->passthrough_filp);
+		ff->passthrough_filp = NULL;
+	}
+}
+
+static ssize_t fuse_passthrough_rw(struct file *lower,
+				   const struct iovec *iov,
+				   unsigned long nr_segs, loff_t *ppos,
+				   int write)
+{
+	ssize_t (*fn)(struct kiocb *, const struct iovec *,
+		      unsigned long, loff_t);
+	const struct cred *old_cred;
+	struct kiocb kiocb;
+	size_t len = iov_length(iov, nr_segs);
+	ssize_t ret;
+
+	fn = write ? lower->f_op->aio_write : lower->f_op->aio_read;
+
+	/* Act with the credentials the daemon opened the file with */
+	old_cred = override_creds(lower->f_cred);
+
+	ret = rw_verify_area(write ? WRITE : READ, lower, ppos, len);
+	if (ret < 0)
+		goto out;
+
+	init_sync_kiocb(&kiocb, lower);
+	kiocb.ki_pos = *ppos;
+	kiocb.ki_left = len;
+	kiocb.ki_nbytes = len;
+
+	ret = fn(&kiocb, iov, nr_segs, kiocb.ki_pos);
+	if (ret == -EIOCBQUEUED)
+		ret = wait_on_sync_kiocb(&kiocb);
+	*ppos = kiocb.ki_pos;
+out:
+	revert_creds(old_cred);
+
+	if (ret > 0) {
+		if (write)
+			fsnotify_modify(lower);
+		else
+			fsnotify_access(lower);
+	}
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_read(struct kiocb *iocb, const struct iovec *iov,
+			      unsigned long nr_segs, loff_t pos)
+{
+	struct fuse_file *ff = iocb->ki_filp->private_data;
+	ssize_t ret;
+
+	/* Dirty pages of a cached open of the inode are newer than the
+	 * lower file */
+	ret = filemap_write_and_wait(iocb->ki_filp->f_mapping);
+	if (ret)
+		return ret;
+
+	ret = fuse_passthrough_rw(ff->passthrough_filp, iov, nr_segs, &pos, 0);
+	if (ret >= 0)
+		iocb->ki_pos = pos;
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_write(struct kiocb *iocb, const struct iovec *iov,
+			       unsigned long nr_segs, loff_t pos)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough_filp;
+	struct inode *inode = file->f_mapping->host;
+	struct inode *lower_inode = lower->f_mapping->host;
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_inode *fi = get_fuse_inode(inode);
+	struct address_space *mapping = inode->i_mapping;
+	size_t len = iov_length(iov, nr_segs);
+	pgoff_t start, end;
+	ssize_t ret;
+
+	mutex_lock(&inode->i_mutex);
+	if (file->f_flags & O_APPEND)
+		pos = i_size_read(lower_inode);
+
+	/*
+	 * Pages of a cached open of the same inode must not be written
+	 * back over the new data later, so flush and drop them first.
+	 */
+	start = pos >> PAGE_CACHE_SHIFT;
+	end = (pos + len - 1) >> PAGE_CACHE_SHIFT;
+	if (len && mapping->nrpages) {
+		ret = filemap_write_and_wait(mapping);
+		if (!ret)
+			ret = invalidate_inode_pages2_range(mapping, start, end);
+		if (ret) {
+			mutex_unlock(&inode->i_mutex);
+			return ret;
+		}
+	}
+
+	ret = fuse_passthrough_rw(lower, iov, nr_segs, &pos, 1);
+	if (ret >= 0)
+		iocb->ki_pos = pos;
+
+	/* The lower file is authoritative for the size */
+	spin_lock(&fc->lock);
+	fi->attr_version = ++fc->attr_version;
+	i_size_write(inode, i_size_read(lower_inode));
+	spin_unlock(&fc->lock);
+
+	/*
+	 * Drop what a reader may have brought in meanwhile.  Anything
+	 * still busy here was dirtied after our write by another writer
+	 * and will legitimately land on top of it, like for O_DIRECT.
+	 */
+	if (ret > 0 && mapping->nrpages)
+		invalidate_inode_pages2_range(mapping, start, end);
+	mutex_unlock(&inode->i_mutex);
+
+	fuse_invalidate_attr(inode);
+
+	return ret;
+}
+
+/*
+ * Map the lower file instead.  mmap_region() holds a reference on the
+ * original vm_file, swap it for one on the lower file.
+ */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough_filp;
+	int err;
+
+	if (!lower->f_op->mmap)
+		return -ENODEV;
+
+	get_file(lower);
+	vma->vm_file = lower;
+	err = lower->f_op->mmap(lower, vma);
+	if (err) {
+		vma->vm_file = file;
+		fput(lower);
+		return err;
+	}
+	fput(file);
+
+	return 0;
+}
@@ -498,9 +498,13 @@ int jbd2_cleanup_journal_tail(journal_t *journal)
 	} else if ((transaction = journal->j_committing_transaction) != NULL) {
 		first_tid = transaction->t_tid;
 		blocknr = transaction->t_log_start;
+		if (transaction->t_fc_blocks)
+			blocknr = transaction->t_fc_start;
 	} else if ((transaction = journal->j_running_transaction) != NULL) {
 		first_tid = transaction->t_tid;
 		blocknr = journal->j_head;
+		if (transaction->t_fc_blocks)
+			blocknr = transaction->t_fc_start;
 	} else {
 		first_tid = journal->j_transaction_sequence;
 		blocknr = journal->j_head;
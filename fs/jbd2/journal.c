@@ -44,6 +44,8 @@
 #include <linux/backing-dev.h>
 #include <linux/bitops.h>
 #include <linux/ratelimit.h>
+#include <linux/crc32.h>
+#include <linux/blkdev.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/jbd2.h>
@@ -662,6 +664,164 @@ int jbd2_log_wait_commit(journal_t *journal, tid_t tid)
 	return err;
 }
 
+/*
+ * Fast commits.
+ *
+ * A fast commit logs a single block of filesystem supplied data for
+ * the running transaction, typically the state of one inode, so that
+ * fsync need not commit the whole transaction.  The block is written
+ * at the log head, ahead of the blocks the transaction itself will be
+ * written to when it commits.  Recovery hands the fast commit blocks
+ * of the first transaction found without a commit record to
+ * j_fc_replay; once the transaction commits they are simply skipped.
+ *
+ * Commits wait for a fast commit in progress, and a fast commit is
+ * refused once a commit of the transaction has been requested.
+ */
+
+/* Upper bound on fast commit blocks per transaction */
+#define JBD2_FC_MAX_BLOCKS	64
+
+__u32 jbd2_fc_chksum(jbd2_journal_fc_header_t *fc)
+{
+	__be32 zero = 0;
+	__u32 crc;
+
+	crc = crc32_be(~0, (void *) fc,
+		       offsetof(jbd2_journal_fc_header_t, h_chksum));
+	crc = crc32_be(crc, (void *) &zero, sizeof(zero));
+	return crc32_be(crc, (void *) (fc + 1), be32_to_cpu(fc->h_len));
+}
+
+/**
+ * int jbd2_fc_commit() - log a fast commit for a running transaction
+ * @journal: the journal
+ * @tid: the transaction the data belongs to
+ * @data: payload, passed to j_fc_replay on recovery
+ * @len: length of the payload
+ *
+ * Returns 0 once the block is on stable storage, together with all
+ * data written before the call.  -EAGAIN means @tid can't take a fast
+ * commit (it is no longer running, is being committed, or the log is
+ * short of space) and the caller has to commit the transaction.
+ */
+int jbd2_fc_commit(journal_t *journal, tid_t tid, const void *data,
+		   unsigned int len)
+{
+	transaction_t *transaction;
+	jbd2_journal_fc_header_t *fc;
+	struct buffer_head *bh;
+	unsigned long blocknr;
+	unsigned long long pblock;
+	int err;
+
+	if (!JBD2_HAS_INCOMPAT_FEATURE(journal,
+				       JBD2_FEATURE_INCOMPAT_FAST_COMMIT))
+		return -EOPNOTSUPP;
+	if (len > journal->j_blocksize - sizeof(*fc))
+		return -E2BIG;
+
+	write_lock(&journal->j_state_lock);
+	for (;;) {
+		DEFINE_WAIT(wait);
+
+		/* The log must not have commit blocks of an older
+		 * transaction interleaved with ours */
+		transaction = journal->j_committing_transaction;
+		if (transaction && tid_gt(tid, transaction->t_tid)) {
+			tid_t commit_tid = transaction->t_tid;
+
+			write_unlock(&journal->j_state_lock);
+			err = jbd2_log_wait_commit(journal, commit_tid);
+			if (err)
+				return err;
+			write_lock(&journal->j_state_lock);
+			continue;
+		}
+		/* One fast commit at a time */
+		if (!(journal->j_flags & JBD2_FAST_COMMIT_ONGOING))
+			break;
+		prepare_to_wait(&journal->j_wait_fc, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		write_lock(&journal->j_state_lock);
+		finish_wait(&journal->j_wait_fc, &wait);
+	}
+
+	transaction = journal->j_running_transaction;
+	if (is_journal_aborted(journal) ||
+	    (journal->j_flags & JBD2_FLUSHED) ||
+	    journal->j_committing_transaction || !transaction ||
+	    transaction->t_tid != tid ||
+	    transaction->t_state != T_RUNNING ||
+	    tid_geq(journal->j_commit_request, tid) ||
+	    transaction->t_fc_blocks >= JBD2_FC_MAX_BLOCKS ||
+	    __jbd2_log_space_left(journal) <= jbd_space_needed(journal)) {
+		write_unlock(&journal->j_state_lock);
+		return -EAGAIN;
+	}
+
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	blocknr = journal->j_head;
+	if (!transaction->t_fc_blocks++)
+		transaction->t_fc_start = blocknr;
+	journal->j_head++;
+	journal->j_free--;
+	if (journal->j_head == journal->j_last)
+		journal->j_head = journal->j_first;
+	write_unlock(&journal->j_state_lock);
+
+	/*
+	 * From here on the log block is ours, a failure leaves a hole in
+	 * the log and has to abort the journal.
+	 */
+	err = jbd2_journal_bmap(journal, blocknr, &pblock);
+	if (err)
+		goto out;
+
+	if (journal->j_fs_dev != journal->j_dev &&
+	    (journal->j_flags & JBD2_BARRIER))
+		blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh) {
+		err = -ENOMEM;
+		goto out;
+	}
+	lock_buffer(bh);
+	memset(bh->b_data, 0, journal->j_blocksize);
+	fc = (jbd2_journal_fc_header_t *) bh->b_data;
+	fc->h_header.h_magic = cpu_to_be32(JBD2_MAGIC_NUMBER);
+	fc->h_header.h_blocktype = cpu_to_be32(JBD2_FC_BLOCK);
+	fc->h_header.h_sequence = cpu_to_be32(tid);
+	fc->h_len = cpu_to_be32(len);
+	memcpy(fc + 1, data, len);
+	fc->h_chksum = cpu_to_be32(jbd2_fc_chksum(fc));
+	set_buffer_uptodate(bh);
+	clear_buffer_dirty(bh);
+	get_bh(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	submit_bh((journal->j_flags & JBD2_BARRIER) ?
+		  WRITE_FLUSH_FUA : WRITE_SYNC, bh);
+	wait_on_buffer(bh);
+	if (!buffer_uptodate(bh))
+		err = -EIO;
+	brelse(bh);
+
+ out:
+	if (err)
+		jbd2_journal_abort(journal, err);
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	if (!err)
+		journal->j_fc_count++;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_wait_fc);
+	return err;
+}
+EXPORT_SYMBOL(jbd2_fc_commit);
+
 /*
  * Log buffer allocation routines:
  */
@@ -790,6 +950,7 @@ static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 	    s->stats->run.rs_blocks / s->stats->ts_tid);
 	seq_printf(seq, "  %lu logged blocks per transaction\n",
 	    s->stats->run.rs_blocks_logged / s->stats->ts_tid);
+	seq_printf(seq, "%lu fast commits\n", s->journal->j_fc_count);
 	return 0;
 }
 
@@ -891,6 +1052,7 @@ static journal_t * journal_init_common (void)
 	init_waitqueue_head(&journal->j_wait_transaction_locked);
 	init_waitqueue_head(&journal->j_wait_logspace);
 	init_waitqueue_head(&journal->j_wait_done_commit);
+	init_waitqueue_head(&journal->j_wait_fc);
 	init_waitqueue_head(&journal->j_wait_checkpoint);
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
@@ -35,6 +35,12 @@ struct recovery_info
 	int		nr_replays;
 	int		nr_revokes;
 	int		nr_revoke_hits;
+
+	/* Fast commit blocks of the last transaction seen in the log */
+	tid_t		fc_sequence;
+	unsigned long	fc_start;
+	int		fc_count;
+	int		nr_fc_replays;
 };
 
 enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
@@ -42,6 +48,7 @@ static int do_one_pass(journal_t *journal,
 				struct recovery_info *info, enum passtype pass);
 static int scan_revoke_records(journal_t *, struct buffer_head *,
 				tid_t, struct recovery_info *);
+static int replay_fc_blocks(journal_t *, struct recovery_info *);
 
 #ifdef __KERNEL__
 
@@ -250,12 +257,16 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	/* Fast commits of the transaction that never committed */
+	if (!err && info.fc_count && info.fc_sequence == info.end_transaction)
+		err = replay_fc_blocks(journal, &info);
 
 	jbd_debug(1, "JBD: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
 		  err, info.start_transaction, info.end_transaction);
 	jbd_debug(1, "JBD: Replayed %d and revoked %d/%d blocks\n",
 		  info.nr_replays, info.nr_revoke_hits, info.nr_revokes);
+	jbd_debug(1, "JBD: Replayed %d fast commits\n", info.nr_fc_replays);
 
 	/* Restart the log at the next transaction ID, thus invalidating
 	 * any existing commit records in the log. */
@@ -393,6 +404,7 @@ static int do_one_pass(journal_t *journal,
 		journal_block_tag_t *	tag;
 		struct buffer_head *	obh;
 		struct buffer_head *	nbh;
+		unsigned long		this_block;
 
 		cond_resched();
 
@@ -416,6 +428,7 @@ static int do_one_pass(journal_t *journal,
 		if (err)
 			goto failed;
 
+		this_block = next_log_block;
 		next_log_block++;
 		wrap(journal, next_log_block);
 
@@ -666,6 +679,37 @@ static int do_one_pass(journal_t *journal,
 				goto failed;
 			continue;
 
+		case JBD2_FC_BLOCK:
+			/* Fast commit blocks only matter for a transaction
+			 * without a commit block, which the replay passes
+			 * never reach.  In PASS_SCAN remember where they
+			 * are; a torn one marks the end of the log. */
+			if (pass != PASS_SCAN) {
+				brelse(bh);
+				continue;
+			}
+			if (!info->end_transaction) {
+				jbd2_journal_fc_header_t *fc =
+					(jbd2_journal_fc_header_t *)bh->b_data;
+
+				if (be32_to_cpu(fc->h_len) >
+				    journal->j_blocksize - sizeof(*fc) ||
+				    be32_to_cpu(fc->h_chksum) !=
+				    jbd2_fc_chksum(fc)) {
+					brelse(bh);
+					goto done;
+				}
+				if (!info->fc_count ||
+				    info->fc_sequence != sequence) {
+					info->fc_sequence = sequence;
+					info->fc_start = this_block;
+					info->fc_count = 0;
+				}
+				info->fc_count++;
+			}
+			brelse(bh);
+			continue;
+
 		default:
 			jbd_debug(3, "Unrecognised magic %d, end of scan.\n",
 				  blocktype);
@@ -704,6 +748,40 @@ static int do_one_pass(journal_t *journal,
 }
 
 
+/* Hand the fast commit blocks found by PASS_SCAN to the filesystem. */
+
+static int replay_fc_blocks(journal_t *journal, struct recovery_info *info)
+{
+	unsigned long log_block = info->fc_start;
+	struct buffer_head *bh;
+	int i, err;
+
+	if (!journal->j_fc_replay) {
+		printk(KERN_WARNING "JBD: %d fast commits of transaction %u "
+		       "ignored, no replay handler\n",
+		       info->fc_count, info->fc_sequence);
+		return 0;
+	}
+
+	for (i = 0; i < info->fc_count; i++) {
+		jbd2_journal_fc_header_t *fc;
+
+		err = jread(&bh, journal, log_block);
+		if (err)
+			return err;
+		fc = (jbd2_journal_fc_header_t *)bh->b_data;
+		err = journal->j_fc_replay(journal, fc + 1,
+					   be32_to_cpu(fc->h_len));
+		brelse(bh);
+		if (err)
+			return err;
+		++info->nr_fc_replays;
+		log_block++;
+		wrap(journal, log_block);
+	}
+	return 0;
+}
+
 /* Scan a revoke record, marking all blocks mentioned as revoked. */
 
 static int scan_revoke_records(journal_t *journal, struct buffer_head *bh,
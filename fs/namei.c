@@ -1665,6 +1665,53 @@ int vfs_path_lookup(struct dentry *dentry, struct vfsmount *mnt,
 	return do_path_lookup(AT_FDCWD, name, flags | LOOKUP_ROOT, nd);
 }
 
+/*
+ * Directories with S_PDIROPS set let create and unlink of non-directories
+ * run without i_mutex: the name is looked up and checked under i_mutex,
+ * the dentry is marked DCACHE_PDIROP and i_mutex is dropped around the
+ * call into the filesystem, which does its own locking of the directory
+ * contents.  Anyone else looking the name up under i_mutex waits for the
+ * mark to go, so each name still sees one operation at a time.  Whatever
+ * needs the whole directory quiet (readdir, rmdir or rename over it)
+ * takes i_mutex and then waits for i_pdirops to drop to zero.
+ */
+static DECLARE_WAIT_QUEUE_HEAD(pdirops_wait);
+
+static inline int d_pdirop_busy(struct dentry *dentry)
+{
+	return ACCESS_ONCE(dentry->d_flags) & DCACHE_PDIROP;
+}
+
+/* Called with dir->i_mutex held */
+static void pdirop_begin(struct inode *dir, struct dentry *dentry)
+{
+	spin_lock(&dentry->d_lock);
+	dentry->d_flags |= DCACHE_PDIROP;
+	spin_unlock(&dentry->d_lock);
+	atomic_inc(&dir->i_pdirops);
+}
+
+static void pdirop_end(struct inode *dir, struct dentry *dentry)
+{
+	spin_lock(&dentry->d_lock);
+	dentry->d_flags &= ~DCACHE_PDIROP;
+	spin_unlock(&dentry->d_lock);
+	atomic_dec(&dir->i_pdirops);
+	smp_mb();
+	if (waitqueue_active(&pdirops_wait))
+		wake_up_all(&pdirops_wait);
+}
+
+/**
+ * inode_pdirops_wait - wait for unlocked directory operations to finish
+ * @dir:	directory, with i_mutex held
+ */
+void inode_pdirops_wait(struct inode *dir)
+{
+	wait_event(pdirops_wait, !atomic_read(&dir->i_pdirops));
+}
+EXPORT_SYMBOL(inode_pdirops_wait);
+
 static struct dentry *__lookup_hash(struct qstr *name,
 		struct dentry *base, struct nameidata *nd)
 {
@@ -1681,8 +1728,17 @@ static struct dentry *__lookup_hash(struct qstr *name,
 	 * well as unlink, so a lot of the time it would cost
 	 * a double lookup.
 	 */
+again:
 	dentry = d_lookup(base, name);
 
+	if (dentry && unlikely(d_pdirop_busy(dentry))) {
+		wait_event(pdirops_wait, !d_pdirop_busy(dentry));
+		if (d_unhashed(dentry)) {
+			dput(dentry);
+			goto again;
+		}
+	}
+
 	if (dentry && (dentry->d_flags & DCACHE_OP_REVALIDATE))
 		dentry = do_revalidate(dentry, nd);
 
@@ -2152,10 +2208,19 @@ static struct file *do_last(struct nameidata *nd, struct path *path,
 		error = security_path_mknod(&nd->path, dentry, mode, 0);
 		if (error)
 			goto exit_mutex_unlock;
-		error = vfs_create(dir->d_inode, dentry, mode, nd);
-		if (error)
-			goto exit_mutex_unlock;
-		mutex_unlock(&dir->d_inode->i_mutex);
+		if (IS_PDIROPS(dir->d_inode)) {
+			pdirop_begin(dir->d_inode, dentry);
+			mutex_unlock(&dir->d_inode->i_mutex);
+			error = vfs_create(dir->d_inode, dentry, mode, nd);
+			pdirop_end(dir->d_inode, dentry);
+			if (error)
+				goto exit_dput;
+		} else {
+			error = vfs_create(dir->d_inode, dentry, mode, nd);
+			if (error)
+				goto exit_mutex_unlock;
+			mutex_unlock(&dir->d_inode->i_mutex);
+		}
 		dput(nd->path.dentry);
 		nd->path.dentry = dentry;
 		goto common;
@@ -2584,6 +2649,7 @@ int vfs_rmdir(struct inode *dir, struct dentry *dentry)
 
 	dget(dentry);
 	mutex_lock(&dentry->d_inode->i_mutex);
+	inode_pdirops_wait(dentry->d_inode);
 
 	error = -EBUSY;
 	if (d_mountpoint(dentry))
@@ -2712,6 +2778,8 @@ static long do_unlinkat(int dfd, const char __user *pathname)
 	struct dentry *dentry;
 	struct nameidata nd;
 	struct inode *inode = NULL;
+	struct inode *dir;
+	int locked = 1;
 
 	error = user_path_parent(dfd, pathname, &nd, &name);
 	if (error)
@@ -2723,7 +2791,8 @@ static long do_unlinkat(int dfd, const char __user *pathname)
 
 	nd.flags &= ~LOOKUP_PARENT;
 
-	mutex_lock_nested(&nd.path.dentry->d_inode->i_mutex, I_MUTEX_PARENT);
+	dir = nd.path.dentry->d_inode;
+	mutex_lock_nested(&dir->i_mutex, I_MUTEX_PARENT);
 	dentry = lookup_hash(&nd);
 	error = PTR_ERR(dentry);
 	if (!IS_ERR(dentry)) {
@@ -2740,13 +2809,21 @@ static long do_unlinkat(int dfd, const char __user *pathname)
 		error = security_path_unlink(&nd.path, dentry);
 		if (error)
 			goto exit3;
-		error = vfs_unlink(nd.path.dentry->d_inode, dentry);
+		if (IS_PDIROPS(dir) && !S_ISDIR(inode->i_mode)) {
+			pdirop_begin(dir, dentry);
+			mutex_unlock(&dir->i_mutex);
+			locked = 0;
+			error = vfs_unlink(dir, dentry);
+			pdirop_end(dir, dentry);
+		} else
+			error = vfs_unlink(dir, dentry);
 exit3:
 		mnt_drop_write(nd.path.mnt);
 	exit2:
 		dput(dentry);
 	}
-	mutex_unlock(&nd.path.dentry->d_inode->i_mutex);
+	if (locked)
+		mutex_unlock(&dir->i_mutex);
 	if (inode)
 		iput(inode);	/* truncate the inode here */
 exit1:
@@ -3008,8 +3085,10 @@ static int vfs_rename_dir(struct inode *old_dir, struct dentry *old_dentry,
 		return error;
 
 	dget(new_dentry);
-	if (target)
+	if (target) {
 		mutex_lock(&target->i_mutex);
+		inode_pdirops_wait(target);
+	}
 
 	error = -EBUSY;
 	if (d_mountpoint(old_dentry) || d_mountpoint(new_dentry))
@@ -34,6 +34,7 @@ int vfs_readdir(struct file *file, filldir_t filler, void *buf)
 	res = mutex_lock_killable(&inode->i_mutex);
 	if (res)
 		goto out;
+	inode_pdirops_wait(inode);
 
 	res = -ENOENT;
 	if (!IS_DEADDIR(inode)) {
@@ -696,6 +696,36 @@ static int pipe_to_sendpage(struct pipe_inode_info *pipe,
 				    sd->len, &pos, more);
 }
 
+/*
+ * Put the page of @buf in place of *@pagep, which ->write_begin() has
+ * prepared for a write of all of it, so that it is written without a
+ * copy.  Only a page nobody else uses can move: a page cache page that
+ * could be removed from its file, or a gifted user page that is no
+ * longer mapped.  On success *@pagep is the pipe page, locked and with
+ * the reference ->write_end() drops.  Failure just means the data is
+ * copied.
+ */
+static void splice_move_page(struct pipe_inode_info *pipe,
+			     struct pipe_buffer *buf, struct page **pagep)
+{
+	struct page *old = *pagep;
+	struct page *page = buf->page;
+
+	if (buf->ops->steal(pipe, buf))
+		return;
+
+	if (replace_page_cache_stolen(old, page, GFP_KERNEL)) {
+		unlock_page(page);
+		return;
+	}
+	buf->flags |= PIPE_BUF_FLAG_LRU;
+
+	page_cache_get(page);
+	unlock_page(old);
+	page_cache_release(old);
+	*pagep = page;
+}
+
 /*
  * This is a little more tricky than the file -> pipe splicing. There are
  * basically three cases:
@@ -711,8 +741,13 @@ static int pipe_to_sendpage(struct pipe_inode_info *pipe,
  *
  * If asked to move pages to the output file (SPLICE_F_MOVE is set in
  * sd->flags), we attempt to migrate pages from the pipe to the output
- * file address space page cache. This is possible if no one else has
- * the pipe page referenced outside of the pipe and page cache. If
+ * file address space page cache, in place of the page ->write_begin()
+ * set up, so the filesystem has allocated and accounted for it first.
+ * This is possible if no one else has the pipe page referenced outside
+ * of the pipe and page cache, and if the prepared page carries no
+ * private data other than buffer heads of a filesystem that allows
+ * buffer_migrate_page(). Buffer head filesystems therefore still copy
+ * without CONFIG_MIGRATION, and shmem always copies. If
  * SPLICE_F_MOVE isn't set, or we cannot move the page, we simply create
  * a new page in the output file page cache and fill/dirty that.
  */
@@ -737,6 +772,10 @@ int pipe_to_file(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
 	if (unlikely(ret))
 		goto out;
 
+	if ((sd->flags & SPLICE_F_MOVE) && !offset && !buf->offset &&
+	    this_len == PAGE_CACHE_SIZE && buf->page != page)
+		splice_move_page(pipe, buf, &page);
+
 	if (buf->page != page) {
 		/*
 		 * Careful, ->map() uses KM_USER0!
@@ -26,6 +26,7 @@
 #include "yaffs_yaffs2.h"
 #include "yaffs_bitmap.h"
 #include "yaffs_verify.h"
+#include "yaffs_summary.h"
 
 #include "yaffs_nand.h"
 #include "yaffs_packedtags2.h"
@@ -440,8 +441,8 @@ static int yaffs_find_alloc_block(struct yaffs_dev *dev)
 	return -1;
 }
 
-static int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
-			     struct yaffs_block_info **block_ptr)
+int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
+		      struct yaffs_block_info **block_ptr)
 {
 	int ret_val;
 	struct yaffs_block_info *bi;
@@ -474,6 +475,9 @@ static int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
 
 		dev->n_free_chunks--;
 
+		if (dev->batch_chunks > 0)
+			dev->batch_chunks--;
+
 		/* If the block is full set the state to full */
 		if (dev->alloc_page >= dev->param.chunks_per_block) {
 			bi->block_state = YAFFS_BLOCK_STATE_FULL;
@@ -617,6 +621,9 @@ static int yaffs_write_new_chunk(struct yaffs_dev *dev,
 		dev->n_retired_writes += (attempts - 1);
 	}
 
+	if (chunk >= 0)
+		yaffs_summary_add(dev, tags, chunk);
+
 	return chunk;
 }
 
@@ -2886,6 +2893,7 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 {
 	int aggressive = 0;
+	int whole_block;
 	int gc_ok = YAFFS_OK;
 	int max_tries = 0;
 	int min_erased;
@@ -2954,11 +2962,24 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 			if (!aggressive)
 				dev->passive_gc_count++;
 
+			/* A writer only collects a whole block once we are
+			 * into the reserved blocks.  Above that it copies a
+			 * few chunks per write and leaves the rest of the
+			 * block to later writes and the background thread,
+			 * which keeps gc out of the write latency.
+			 */
+			whole_block = aggressive;
+			if (aggressive && !background &&
+			    dev->n_erased_blocks >= dev->param.n_reserved_blocks) {
+				whole_block = 0;
+				dev->fg_gc_bounded++;
+			}
+
 			yaffs_trace(YAFFS_TRACE_GC,
-				"yaffs: GC n_erased_blocks %d aggressive %d",
-				dev->n_erased_blocks, aggressive);
+				"yaffs: GC n_erased_blocks %d aggressive %d whole %d",
+				dev->n_erased_blocks, aggressive, whole_block);
 
-			gc_ok = yaffs_gc_block(dev, dev->gc_block, aggressive);
+			gc_ok = yaffs_gc_block(dev, dev->gc_block, whole_block);
 		}
 
 		if (dev->n_erased_blocks < (dev->param.n_reserved_blocks)
@@ -2989,6 +3010,41 @@ int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency)
 	return erased_chunks > dev->n_free_chunks / 2;
 }
 
+/*
+ * yaffs_wr_begin_batch()
+ * Writeback of a run of dirty pages calls this before writing the run.
+ * The gc check is done once here, and the following chunks, up to
+ * n_chunks, are then allocated straight off the erased blocks without
+ * checking again per chunk.  The batch is limited to what can be
+ * written without dipping into the reserved and checkpoint blocks, so
+ * skipping gc for it is safe.
+ */
+void yaffs_wr_begin_batch(struct yaffs_dev *dev, int n_chunks)
+{
+	int reserved_chunks;
+	int available;
+
+	yaffs_check_gc(dev, 0);
+
+	reserved_chunks = (dev->param.n_reserved_blocks +
+			   yaffs_calc_checkpt_blocks_required(dev) + 1) *
+			  dev->param.chunks_per_block;
+	available = yaffs_get_erased_chunks(dev) - reserved_chunks;
+
+	if (n_chunks > available)
+		n_chunks = available;
+
+	dev->batch_chunks = (n_chunks > 0) ? n_chunks : 0;
+
+	yaffs_trace(YAFFS_TRACE_GC, "yaffs: write batch of %d chunks",
+		dev->batch_chunks);
+}
+
+void yaffs_wr_end_batch(struct yaffs_dev *dev)
+{
+	dev->batch_chunks = 0;
+}
+
 /*-------------------- Data file manipulation -----------------*/
 
 static int yaffs_rd_data_obj(struct yaffs_obj *in, int inode_chunk, u8 * buffer)
@@ -3089,7 +3145,8 @@ static int yaffs_wr_data_obj(struct yaffs_obj *in, int inode_chunk,
 
 	struct yaffs_dev *dev = in->my_dev;
 
-	yaffs_check_gc(dev, 0);
+	if (dev->batch_chunks <= 0)
+		yaffs_check_gc(dev, 0);
 
 	/* Get the previous chunk at this location in the file if it exists.
 	 * If it does not exist then put a zero into the tree. This creates
@@ -4916,6 +4973,7 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->passive_gc_count = 0;
 	dev->oldest_dirty_gc_count = 0;
 	dev->bg_gcs = 0;
+	dev->fg_gc_bounded = 0;
 	dev->gc_block_finder = 0;
 	dev->buffered_block = -1;
 	dev->doing_buffered_block_rewrite = 0;
@@ -4938,6 +4996,9 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	if (!yaffs_init_tmp_buffers(dev))
 		init_failed = 1;
 
+	if (!init_failed && !yaffs_summary_init(dev))
+		init_failed = 1;
+
 	dev->cache = NULL;
 	dev->gc_cleanup_list = NULL;
 
@@ -5090,6 +5151,8 @@ void yaffs_deinitialise(struct yaffs_dev *dev)
 
 		kfree(dev->gc_cleanup_list);
 
+		yaffs_summary_deinit(dev);
+
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
 			kfree(dev->temp_buffer[i].buffer);
 
@@ -78,8 +78,8 @@
 #define YAFFS_OBJECTID_UNLINKED		3
 #define YAFFS_OBJECTID_DELETED		4
 
-/* Pseudo object ids for checkpointing */
-#define YAFFS_OBJECTID_SB_HEADER	0x10
+/* Pseudo object ids for checkpointing and block summaries */
+#define YAFFS_OBJECTID_SUMMARY		0x10
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
@@ -574,6 +574,8 @@ struct yaffs_param {
 	int auto_unicode;
 #endif
 	int always_check_erased;	/* Force chunk erased check always on */
+
+	int disable_summary;	/* Don't write block summaries */
 };
 
 struct yaffs_dev {
@@ -632,6 +634,12 @@ struct yaffs_dev {
 
 	int checkpoint_blocks_required;	/* Number of blocks needed to store current checkpoint set */
 
+	/* Block summaries, see yaffs_summary.c */
+	int chunks_per_summary;	/* Data chunks per block, 0 if no summaries */
+	int n_summary_chunks;
+	int sum_block;		/* Block the summary buffer is collecting */
+	u8 *sum_buffer;
+
 	/* Block Info */
 	struct yaffs_block_info *block_info;
 	u8 *chunk_bits;		/* bitmap of chunks in use */
@@ -672,6 +680,10 @@ struct yaffs_dev {
 	unsigned gc_chunk;
 	unsigned gc_skip;
 
+	/* Chunks that may still be written without a gc check, see
+	 * yaffs_wr_begin_batch() */
+	int batch_chunks;
+
 	/* Special directories */
 	struct yaffs_obj *root_dir;
 	struct yaffs_obj *lost_n_found;
@@ -724,6 +736,7 @@ struct yaffs_dev {
 	u32 oldest_dirty_gc_count;
 	u32 n_gc_blocks;
 	u32 bg_gcs;
+	u32 fg_gc_bounded;	/* Foreground gcs held to a partial block */
 	u32 n_retired_writes;
 	u32 n_retired_blocks;
 	u32 n_ecc_fixed;
@@ -858,6 +871,10 @@ void yaffs_update_dirty_dirs(struct yaffs_dev *dev);
 
 int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency);
 
+/* Batched writeback */
+void yaffs_wr_begin_batch(struct yaffs_dev *dev, int n_chunks);
+void yaffs_wr_end_batch(struct yaffs_dev *dev);
+
 /* Debug dump  */
 int yaffs_dump_obj(struct yaffs_obj *obj);
 
@@ -901,6 +918,8 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 		     int n_bytes, int write_trhrough);
 void yaffs_resize_file_down(struct yaffs_obj *obj, loff_t new_size);
 void yaffs_skip_rest_of_block(struct yaffs_dev *dev);
+int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
+		      struct yaffs_block_info **block_ptr);
 
 int yaffs_count_free_chunks(struct yaffs_dev *dev);
 
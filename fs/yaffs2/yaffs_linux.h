@@ -18,6 +18,8 @@
 
 #include "yportenv.h"
 
+#define YAFFS_N_WRITE_LAT 14
+
 struct yaffs_linux_context {
 	struct list_head context_list;	/* List of these we have mounted */
 	struct yaffs_dev *dev;
@@ -33,6 +35,11 @@ struct yaffs_linux_context {
 
 	struct task_struct *readdir_process;
 	unsigned mount_id;
+
+	unsigned long last_write;	/* jiffies, for idle gc */
+	/* Page write latency, bucket n counts writes taking under
+	 * 64 << n us, the last bucket the rest. */
+	u32 write_lat[YAFFS_N_WRITE_LAT];
 };
 
 #define yaffs_dev_to_lc(dev) ((struct yaffs_linux_context *)((dev)->os_context))
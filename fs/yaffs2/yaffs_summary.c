@@ -0,0 +1,266 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Block summaries.
+ *
+ * The last chunks of each yaffs2 block hold a summary: the tags of all
+ * the other chunks in the block.  A scan after an unclean shutdown can
+ * then read the summary instead of the tags of every chunk.
+ *
+ * The summary is a header followed by one yaffs_summary_tags per data
+ * chunk, written across the summary chunks with pseudo object id
+ * YAFFS_OBJECTID_SUMMARY.  Summary chunks are deleted as soon as they
+ * are written, so gc never copies them and they are erased with the
+ * block.
+ *
+ * Blocks without a valid summary (older images, the block that was
+ * being written when power went) are scanned chunk by chunk as before.
+ */
+
+#include "yaffs_summary.h"
+#include "yaffs_nand.h"
+#include "yaffs_getblockinfo.h"
+#include "yaffs_tagsvalidity.h"
+#include "yaffs_trace.h"
+
+#define YAFFS_SUMMARY_VERSION	1
+
+struct yaffs_summary_header {
+	u32 version;	/* YAFFS_SUMMARY_VERSION */
+	u32 block;	/* Block the summary is in */
+	u32 seq;	/* Sequence number of that block */
+	u32 sum;	/* Sum of the bytes of the tags */
+};
+
+struct yaffs_summary_tags {
+	u32 obj_id;	/* 0 if the chunk was not written */
+	u32 chunk_id;
+	u32 n_bytes;
+};
+
+static struct yaffs_summary_tags *yaffs_summary_tags(struct yaffs_dev *dev)
+{
+	return (struct yaffs_summary_tags *)
+	    (dev->sum_buffer + sizeof(struct yaffs_summary_header));
+}
+
+static u32 yaffs_summary_sum(struct yaffs_dev *dev)
+{
+	u8 *p = (u8 *) yaffs_summary_tags(dev);
+	int n = dev->chunks_per_summary * sizeof(struct yaffs_summary_tags);
+	u32 sum = 0;
+
+	while (n--)
+		sum += *p++;
+
+	return sum;
+}
+
+static void yaffs_summary_clear(struct yaffs_dev *dev)
+{
+	memset(dev->sum_buffer, 0,
+	       dev->n_summary_chunks * dev->data_bytes_per_chunk);
+}
+
+int yaffs_summary_init(struct yaffs_dev *dev)
+{
+	int n_chunks = 1;
+
+	dev->chunks_per_summary = 0;
+	dev->sum_block = -1;
+
+	if (!dev->param.is_yaffs2 || dev->param.disable_summary)
+		return YAFFS_OK;
+
+	/* Enough chunks to hold the header and the tags of the rest */
+	while (sizeof(struct yaffs_summary_header) +
+	       (dev->param.chunks_per_block - n_chunks) *
+	       sizeof(struct yaffs_summary_tags) >
+	       n_chunks * dev->data_bytes_per_chunk)
+		n_chunks++;
+
+	if (n_chunks >= dev->param.chunks_per_block / 2)
+		return YAFFS_OK;
+
+	dev->sum_buffer = kmalloc(n_chunks * dev->data_bytes_per_chunk,
+				  GFP_NOFS);
+	if (!dev->sum_buffer)
+		return YAFFS_FAIL;
+
+	dev->n_summary_chunks = n_chunks;
+	dev->chunks_per_summary = dev->param.chunks_per_block - n_chunks;
+	yaffs_summary_clear(dev);
+
+	return YAFFS_OK;
+}
+
+void yaffs_summary_deinit(struct yaffs_dev *dev)
+{
+	kfree(dev->sum_buffer);
+	dev->sum_buffer = NULL;
+	dev->chunks_per_summary = 0;
+}
+
+static void yaffs_summary_write(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_summary_header *hdr =
+	    (struct yaffs_summary_header *)dev->sum_buffer;
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_ext_tags tags;
+	int first = blk * dev->param.chunks_per_block +
+	    dev->chunks_per_summary;
+	int chunk;
+	int result;
+	int i;
+
+	hdr->version = YAFFS_SUMMARY_VERSION;
+	hdr->block = blk;
+	hdr->seq = bi->seq_number;
+	hdr->sum = yaffs_summary_sum(dev);
+
+	for (i = 0; i < dev->n_summary_chunks; i++) {
+		chunk = yaffs_alloc_chunk(dev, 1, NULL);
+		if (chunk < 0)
+			break;
+
+		if (chunk != first + i) {
+			/* Not our block any more, give up on this summary */
+			yaffs_chunk_del(dev, chunk, 1, __LINE__);
+			break;
+		}
+
+		yaffs_init_tags(&tags);
+		tags.obj_id = YAFFS_OBJECTID_SUMMARY;
+		tags.chunk_id = i + 1;
+		tags.n_bytes = dev->data_bytes_per_chunk;
+
+		result = yaffs_wr_chunk_tags_nand(dev, chunk,
+				dev->sum_buffer + i * dev->data_bytes_per_chunk,
+				&tags);
+
+		/* Nothing lives in a summary chunk */
+		yaffs_chunk_del(dev, chunk, 1, __LINE__);
+
+		if (result != YAFFS_OK)
+			break;
+	}
+
+	yaffs_trace(YAFFS_TRACE_WRITE, "summary for block %d %s",
+		blk, i == dev->n_summary_chunks ? "written" : "aborted");
+}
+
+/*
+ * Record the tags of a chunk written off the allocation block.  Once the
+ * data chunks of the block are all written the summary goes into the
+ * rest of the block.
+ */
+void yaffs_summary_add(struct yaffs_dev *dev, struct yaffs_ext_tags *tags,
+		       int chunk_in_nand)
+{
+	struct yaffs_summary_tags *st;
+	int blk = chunk_in_nand / dev->param.chunks_per_block;
+	int chunk_in_block = chunk_in_nand % dev->param.chunks_per_block;
+
+	if (!dev->chunks_per_summary)
+		return;
+
+	if (chunk_in_block == 0) {
+		yaffs_summary_clear(dev);
+		dev->sum_block = blk;
+	}
+
+	/* Blocks we did not start (resumed after mount) get no summary */
+	if (blk != dev->sum_block ||
+	    chunk_in_block >= dev->chunks_per_summary)
+		return;
+
+	st = yaffs_summary_tags(dev) + chunk_in_block;
+	st->obj_id = tags->obj_id;
+	st->chunk_id = tags->chunk_id;
+	st->n_bytes = tags->n_bytes;
+
+	if (chunk_in_block == dev->chunks_per_summary - 1) {
+		dev->sum_block = -1;
+		yaffs_summary_write(dev, blk);
+	}
+}
+
+/*
+ * Read the summary of a block into the summary buffer.
+ * Returns YAFFS_OK if the block has a valid summary.
+ */
+int yaffs_summary_read(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_summary_header *hdr =
+	    (struct yaffs_summary_header *)dev->sum_buffer;
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_ext_tags tags;
+	int first = blk * dev->param.chunks_per_block +
+	    dev->chunks_per_summary;
+	int i;
+
+	if (!dev->chunks_per_summary)
+		return YAFFS_FAIL;
+
+	for (i = 0; i < dev->n_summary_chunks; i++) {
+		yaffs_rd_chunk_tags_nand(dev, first + i,
+				dev->sum_buffer + i * dev->data_bytes_per_chunk,
+				&tags);
+
+		if (!tags.chunk_used ||
+		    tags.ecc_result == YAFFS_ECC_RESULT_UNFIXED ||
+		    tags.obj_id != YAFFS_OBJECTID_SUMMARY ||
+		    tags.chunk_id != i + 1 ||
+		    tags.seq_number != bi->seq_number)
+			return YAFFS_FAIL;
+	}
+
+	if (hdr->version != YAFFS_SUMMARY_VERSION ||
+	    hdr->block != blk ||
+	    hdr->seq != bi->seq_number ||
+	    hdr->sum != yaffs_summary_sum(dev))
+		return YAFFS_FAIL;
+
+	return YAFFS_OK;
+}
+
+/*
+ * Tags for a chunk of the block whose summary was last read, as the scan
+ * would have read them from flash.
+ */
+void yaffs_summary_fetch(struct yaffs_dev *dev, struct yaffs_ext_tags *tags,
+			 int chunk_in_block)
+{
+	struct yaffs_summary_header *hdr =
+	    (struct yaffs_summary_header *)dev->sum_buffer;
+	struct yaffs_summary_tags *st;
+
+	yaffs_init_tags(tags);
+	tags->seq_number = hdr->seq;
+	tags->ecc_result = YAFFS_ECC_RESULT_NO_ERROR;
+
+	if (chunk_in_block >= dev->chunks_per_summary) {
+		tags->chunk_used = 1;
+		tags->obj_id = YAFFS_OBJECTID_SUMMARY;
+		tags->chunk_id = chunk_in_block - dev->chunks_per_summary + 1;
+		tags->n_bytes = dev->data_bytes_per_chunk;
+		return;
+	}
+
+	st = yaffs_summary_tags(dev) + chunk_in_block;
+	tags->chunk_used = (st->obj_id != 0);
+	tags->obj_id = st->obj_id;
+	tags->chunk_id = st->chunk_id;
+	tags->n_bytes = st->n_bytes;
+}
@@ -44,6 +44,8 @@
 #include <linux/fs.h>
 #include <linux/proc_fs.h>
 #include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/backing-dev.h>
 #include <linux/mtd/mtd.h>
 #include <linux/interrupt.h>
 #include <linux/string.h>
@@ -53,6 +55,7 @@
 #include <linux/kthread.h>
 #include <linux/delay.h>
 #include <linux/freezer.h>
+#include <linux/ktime.h>
 #include <linux/cleancache.h>
 
 #include <asm/div64.h>
@@ -916,18 +919,24 @@ static int yaffs_file_flush(struct file *file, fl_owner_t id)
 	struct yaffs_obj *obj = yaffs_dentry_to_obj(file->f_dentry);
 
 	struct yaffs_dev *dev = obj->my_dev;
+	int ret = 0;
 
 	yaffs_trace(YAFFS_TRACE_OS,
 	  	"yaffs_file_flush object %d (%s)",
 		obj->obj_id, obj->dirty ? "dirty" : "clean");
 
+	/* Written data sits in the page cache until writeback, get it to
+	 * flash on close as before and report a failure to close(). */
+	if (file->f_mode & FMODE_WRITE)
+		ret = filemap_write_and_wait(file->f_mapping);
+
 	yaffs_gross_lock(dev);
 
 	yaffs_flush_file(obj, 1, 0);
 
 	yaffs_gross_unlock(dev);
 
-	return 0;
+	return ret;
 }
 
 static const struct file_operations yaffs_file_operations = {
@@ -1197,6 +1206,22 @@ static int yaffs_readpage(struct file *f, struct page *pg)
 	return ret;
 }
 
+/* Called with the gross lock held at the end of a page write */
+static void yaffs_account_write(struct yaffs_dev *dev, ktime_t start)
+{
+	struct yaffs_linux_context *lc = yaffs_dev_to_lc(dev);
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int bucket = 0;
+
+	us >>= 6;
+	while (us && bucket < YAFFS_N_WRITE_LAT - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	lc->write_lat[bucket]++;
+	lc->last_write = jiffies;
+}
+
 /* writepage inspired by/stolen from smbfs */
 
 static int yaffs_writepage(struct page *page, struct writeback_control *wbc)
@@ -1210,6 +1235,7 @@ static int yaffs_writepage(struct page *page, struct writeback_control *wbc)
 	int n_written = 0;
 	unsigned n_bytes;
 	loff_t i_size;
+	ktime_t start;
 
 	if (!mapping)
 		BUG();
@@ -1250,6 +1276,7 @@ static int yaffs_writepage(struct page *page, struct writeback_control *wbc)
 
 	obj = yaffs_inode_to_obj(inode);
 	dev = obj->my_dev;
+	start = ktime_get();
 	yaffs_gross_lock(dev);
 
 	yaffs_trace(YAFFS_TRACE_OS,
@@ -1268,9 +1295,18 @@ static int yaffs_writepage(struct page *page, struct writeback_control *wbc)
 		"writepag1: obj = %05x, ino = %05x",
 		(int)obj->variant.file_variant.file_size, (int)inode->i_size);
 
+	yaffs_account_write(dev, start);
+
 	yaffs_gross_unlock(dev);
 
 	kunmap(page);
+
+	/* The data only lives in this page now, don't lose it silently */
+	if (n_written != n_bytes) {
+		SetPageError(page);
+		mapping_set_error(mapping, -ENOSPC);
+	}
+
 	set_page_writeback(page);
 	unlock_page(page);
 	end_page_writeback(page);
@@ -1279,45 +1315,71 @@ static int yaffs_writepage(struct page *page, struct writeback_control *wbc)
 	return (n_written == n_bytes) ? 0 : -ENOSPC;
 }
 
-/* Space holding and freeing is done to ensure we have space available for 
- * write_begin/end.
- * For now we just assume few parallel writes and check against a small
- * number.
- * Todo: need to do this with a counter to handle parallel reads better.
+/*
+ * Writeback of a run of dirty pages.  The gc check is done once for the
+ * whole run (see yaffs_wr_begin_batch()) instead of once per chunk, and
+ * the chunks of the run are allocated back to back in the current block.
  */
-
-static ssize_t yaffs_hold_space(struct file *f)
+static int yaffs_writepages(struct address_space *mapping,
+			    struct writeback_control *wbc)
 {
-	struct yaffs_obj *obj;
-	struct yaffs_dev *dev;
-
-	int n_free_chunks;
-
-	obj = yaffs_dentry_to_obj(f->f_dentry);
+	struct yaffs_dev *dev = yaffs_inode_to_obj(mapping->host)->my_dev;
+	long n_pages = min_t(long, wbc->nr_to_write, mapping->nrpages);
+	long n_chunks;
+	int ret;
 
-	dev = obj->my_dev;
+	if (dev->data_bytes_per_chunk <= PAGE_CACHE_SIZE)
+		n_chunks = n_pages *
+			   (PAGE_CACHE_SIZE / dev->data_bytes_per_chunk);
+	else
+		n_chunks = DIV_ROUND_UP(n_pages,
+				dev->data_bytes_per_chunk / PAGE_CACHE_SIZE);
 
 	yaffs_gross_lock(dev);
+	yaffs_wr_begin_batch(dev, min_t(long, n_chunks, INT_MAX));
+	yaffs_gross_unlock(dev);
 
-	n_free_chunks = yaffs_get_n_free_chunks(dev);
+	ret = generic_writepages(mapping, wbc);
 
+	yaffs_gross_lock(dev);
+	yaffs_wr_end_batch(dev);
 	yaffs_gross_unlock(dev);
 
-	return (n_free_chunks > 20) ? 1 : 0;
+	return ret;
 }
 
-static void yaffs_release_space(struct file *f)
+/* Space holding is done to ensure we have space available for
+ * write_begin/end.
+ * Written data now stays in the page cache until writeback allocates
+ * chunks for it, so the dirty pages of the device are counted against
+ * the free space as well.
+ */
+
+static int yaffs_hold_space(struct file *f)
 {
 	struct yaffs_obj *obj;
 	struct yaffs_dev *dev;
+	struct backing_dev_info *bdi = f->f_mapping->backing_dev_info;
+	int chunks_per_page;
+	long n_dirty_chunks;
+
+	int n_free_chunks;
 
 	obj = yaffs_dentry_to_obj(f->f_dentry);
 
 	dev = obj->my_dev;
 
+	chunks_per_page = DIV_ROUND_UP(PAGE_CACHE_SIZE,
+				       dev->data_bytes_per_chunk);
+	n_dirty_chunks = bdi_stat(bdi, BDI_RECLAIMABLE) * chunks_per_page;
+
 	yaffs_gross_lock(dev);
 
+	n_free_chunks = yaffs_get_n_free_chunks(dev);
+
 	yaffs_gross_unlock(dev);
+
+	return (n_free_chunks > 20 + n_dirty_chunks) ? 1 : 0;
 }
 
 static int yaffs_write_begin(struct file *filp, struct address_space *mapping,
@@ -1328,7 +1390,14 @@ static int yaffs_write_begin(struct file *filp, struct address_space *mapping,
 	pgoff_t index = pos >> PAGE_CACHE_SHIFT;
 
 	int ret = 0;
-	int space_held = 0;
+
+	/* Get fs space.  If buffered data is what holds it, push it out
+	 * to flash and look again. */
+	if (!yaffs_hold_space(filp)) {
+		writeback_inodes_sb_if_idle(mapping->host->i_sb);
+		if (!yaffs_hold_space(filp))
+			return -ENOSPC;
+	}
 
 	/* Get a page */
 	pg = grab_cache_page_write_begin(mapping, index, flags);
@@ -1342,14 +1411,6 @@ static int yaffs_write_begin(struct file *filp, struct address_space *mapping,
 		"start yaffs_write_begin index %d(%x) uptodate %d",
 		(int)index, (int)index, Page_Uptodate(pg) ? 1 : 0);
 
-	/* Get fs space */
-	space_held = yaffs_hold_space(filp);
-
-	if (!space_held) {
-		ret = -ENOSPC;
-		goto out;
-	}
-
 	/* Update page if required */
 
 	if (!Page_Uptodate(pg))
@@ -1366,8 +1427,6 @@ static int yaffs_write_begin(struct file *filp, struct address_space *mapping,
 out:
 	yaffs_trace(YAFFS_TRACE_OS,
 		"end yaffs_write_begin fail returning %d", ret);
-	if (space_held)
-		yaffs_release_space(filp);
 	if (pg) {
 		unlock_page(pg);
 		page_cache_release(pg);
@@ -1375,90 +1434,36 @@ out:
 	return ret;
 }
 
-static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
-				loff_t * pos)
-{
-	struct yaffs_obj *obj;
-	int n_written, ipos;
-	struct inode *inode;
-	struct yaffs_dev *dev;
-
-	obj = yaffs_dentry_to_obj(f->f_dentry);
-
-	dev = obj->my_dev;
-
-	yaffs_gross_lock(dev);
-
-	inode = f->f_dentry->d_inode;
-
-	if (!S_ISBLK(inode->i_mode) && f->f_flags & O_APPEND)
-		ipos = inode->i_size;
-	else
-		ipos = *pos;
-
-	if (!obj)
-		yaffs_trace(YAFFS_TRACE_OS,
-			"yaffs_file_write: hey obj is null!");
-	else
-		yaffs_trace(YAFFS_TRACE_OS,
-			"yaffs_file_write about to write writing %u(%x) bytes to object %d at %d(%x)",
-			(unsigned)n, (unsigned)n, obj->obj_id, ipos, ipos);
-
-	n_written = yaffs_wr_file(obj, buf, ipos, n, 0);
-
-	yaffs_touch_super(dev);
-
-	yaffs_trace(YAFFS_TRACE_OS,
-		"yaffs_file_write: %d(%x) bytes written",
-		(unsigned)n, (unsigned)n);
-
-	if (n_written > 0) {
-		ipos += n_written;
-		*pos = ipos;
-		if (ipos > inode->i_size) {
-			inode->i_size = ipos;
-			inode->i_blocks = (ipos + 511) >> 9;
-
-			yaffs_trace(YAFFS_TRACE_OS,
-				"yaffs_file_write size updated to %d bytes, %d blocks",
-				ipos, (int)(inode->i_blocks));
-		}
-
-	}
-	yaffs_gross_unlock(dev);
-	return (n_written == 0) && (n > 0) ? -ENOSPC : n_written;
-}
-
+/*
+ * Delayed allocation: the data is left in the dirty page and no chunk is
+ * allocated until writeback (yaffs_writepages) or a flush writes it.
+ */
 static int yaffs_write_end(struct file *filp, struct address_space *mapping,
 			   loff_t pos, unsigned len, unsigned copied,
 			   struct page *pg, void *fsdadata)
 {
-	int ret = 0;
-	void *addr, *kva;
-	uint32_t offset_into_page = pos & (PAGE_CACHE_SIZE - 1);
-
-	kva = kmap(pg);
-	addr = kva + offset_into_page;
+	struct inode *inode = mapping->host;
+	loff_t end = pos + copied;
 
 	yaffs_trace(YAFFS_TRACE_OS,
-		"yaffs_write_end addr %p pos %x n_bytes %d",
-		addr, (unsigned)pos, copied);
+		"yaffs_write_end pos %x n_bytes %d",
+		(unsigned)pos, copied);
+
+	/* yaffs_write_begin always brings the page uptodate */
+	set_page_dirty(pg);
 
-	ret = yaffs_file_write(filp, addr, copied, &pos);
+	if (end > inode->i_size) {
+		i_size_write(inode, end);
+		inode->i_blocks = (end + 511) >> 9;
 
-	if (ret != copied) {
 		yaffs_trace(YAFFS_TRACE_OS,
-			"yaffs_write_end not same size ret %d  copied %d",
-			ret, copied);
-		SetPageError(pg);
+			"yaffs_write_end size updated to %d bytes, %d blocks",
+			(int)end, (int)(inode->i_blocks));
 	}
 
-	kunmap(pg);
-
-	yaffs_release_space(filp);
 	unlock_page(pg);
 	page_cache_release(pg);
-	return ret;
+	return copied;
 }
 
 static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
@@ -1552,6 +1557,12 @@ static void yaffs_flush_super(struct super_block *sb, int do_checkpoint)
 		yaffs_checkpoint_save(dev);
 }
 
+/* No page has been written for a second */
+static int yaffs_dev_idle(struct yaffs_dev *dev)
+{
+	return time_after(jiffies, yaffs_dev_to_lc(dev)->last_write + HZ);
+}
+
 static unsigned yaffs_bg_gc_urgency(struct yaffs_dev *dev)
 {
 	unsigned erased_chunks =
@@ -1567,7 +1578,8 @@ static unsigned yaffs_bg_gc_urgency(struct yaffs_dev *dev)
 	else if (scattered < (dev->param.chunks_per_block * 2))
 		return 0;
 	else if (erased_chunks > dev->n_free_chunks / 2)
-		return 0;
+		/* Nothing pressing, but use idle time to get ahead */
+		return yaffs_dev_idle(dev) ? 1 : 0;
 	else if (erased_chunks > dev->n_free_chunks / 4)
 		return 1;
 	else
@@ -1769,6 +1781,7 @@ struct yaffs_options {
 	int lazy_loading_overridden;
 	int empty_lost_and_found;
 	int empty_lost_and_found_overridden;
+	int disable_summary;
 };
 
 #define MAX_OPT_LEN 30
@@ -1816,6 +1829,10 @@ static int yaffs_parse_options(struct yaffs_options *options,
 		} else if (!strcmp(cur_opt, "empty-lost-and-found-on")) {
 			options->empty_lost_and_found = 1;
 			options->empty_lost_and_found_overridden = 1;
+		} else if (!strcmp(cur_opt, "summary-off")) {
+			options->disable_summary = 1;
+		} else if (!strcmp(cur_opt, "summary-on")) {
+			options->disable_summary = 0;
 		} else if (!strcmp(cur_opt, "no-cache")) {
 			options->no_cache = 1;
 		} else if (!strcmp(cur_opt, "no-checkpoint-read")) {
@@ -1838,6 +1855,7 @@ static int yaffs_parse_options(struct yaffs_options *options,
 static struct address_space_operations yaffs_file_address_operations = {
 	.readpage = yaffs_readpage,
 	.writepage = yaffs_writepage,
+	.writepages = yaffs_writepages,
 	.write_begin = yaffs_write_begin,
 	.write_end = yaffs_write_end,
 };
@@ -2197,6 +2215,7 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param = &(dev->param);
 
 	memset(context, 0, sizeof(struct yaffs_linux_context));
+	context->last_write = jiffies;
 	dev->os_context = context;
 	INIT_LIST_HEAD(&(context->context_list));
 	context->dev = dev;
@@ -2222,6 +2241,7 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->n_reserved_blocks = 5;
 	param->n_caches = (options.no_cache) ? 0 : 10;
 	param->inband_tags = options.inband_tags;
+	param->disable_summary = options.disable_summary;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
 	param->disable_lazy_load = 1;
@@ -2445,6 +2465,8 @@ static char *yaffs_dump_dev_part0(char *buf, struct yaffs_dev *dev)
 			param->n_reserved_blocks);
 	buf += sprintf(buf, "always_check_erased... %d\n",
 			param->always_check_erased);
+	buf += sprintf(buf, "disable_summary....... %d\n",
+			param->disable_summary);
 
 	return buf;
 }
@@ -2460,6 +2482,8 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_erased_blocks....... %d\n", dev->n_erased_blocks);
 	buf +=
 	    sprintf(buf, "blocks_in_checkpt..... %d\n", dev->blocks_in_checkpt);
+	buf +=
+	    sprintf(buf, "chunks_per_summary.... %d\n", dev->chunks_per_summary);
 	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "n_tnodes.............. %d\n", dev->n_tnodes);
 	buf += sprintf(buf, "n_obj................. %d\n", dev->n_obj);
@@ -2495,6 +2519,22 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_unlinked_files...... %u\n", dev->n_unlinked_files);
 	buf += sprintf(buf, "refresh_count......... %u\n", dev->refresh_count);
 	buf += sprintf(buf, "n_bg_deletions........ %u\n", dev->n_bg_deletions);
+	buf += sprintf(buf, "fg_gc_bounded......... %u\n", dev->fg_gc_bounded);
+
+	return buf;
+}
+
+static char *yaffs_dump_write_lat(char *buf, struct yaffs_dev *dev)
+{
+	struct yaffs_linux_context *lc = yaffs_dev_to_lc(dev);
+	int i;
+
+	buf += sprintf(buf, "\nwrite latency (us)\n");
+	for (i = 0; i < YAFFS_N_WRITE_LAT - 1; i++)
+		buf += sprintf(buf, "  <%-9u........... %u\n",
+			       64 << i, lc->write_lat[i]);
+	buf += sprintf(buf, "  >=%-8u........... %u\n",
+		       64 << i, lc->write_lat[i]);
 
 	return buf;
 }
@@ -2544,6 +2584,7 @@ static int yaffs_proc_read(char *page,
 				buf = yaffs_dump_dev_part0(buf, dev);
 			} else {
 				buf = yaffs_dump_dev_part1(buf, dev);
+				buf = yaffs_dump_write_lat(buf, dev);
                         }
 
 			break;
@@ -37,6 +37,18 @@ struct sg_io_hdr;
 struct request;
 typedef void (rq_end_io_fn)(struct request *, int);
 
+/*
+ * Requests freed on a cpu are parked here and handed back to the next
+ * allocation on that cpu, so they stay cache hot and the common case
+ * never touches the mempool lock.
+ */
+#define BLK_RQ_CACHE_SIZE	16
+
+struct blk_rq_cache {
+	int nr;
+	struct request *rqs[BLK_RQ_CACHE_SIZE];
+};
+
 struct request_list {
 	/*
 	 * count[], starved[], and wait[] are indexed by
@@ -46,6 +58,7 @@ struct request_list {
 	int starved[2];
 	int elvpriv;
 	mempool_t *rq_pool;
+	struct blk_rq_cache __percpu *rq_cache;
 	wait_queue_head_t wait[2];
 };
 
@@ -403,6 +416,7 @@ struct request_queue
 #define QUEUE_FLAG_NOXMERGES   15	/* No extended merges */
 #define QUEUE_FLAG_ADD_RANDOM  16	/* Contributes to random pool */
 #define QUEUE_FLAG_SECDISCARD  17	/* supports SECDISCARD */
+#define QUEUE_FLAG_SAME_FORCE  18	/* force complete on same CPU */
 
 #define QUEUE_FLAG_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
 				 (1 << QUEUE_FLAG_STACKABLE)	|	\
@@ -862,7 +876,10 @@ struct blk_plug {
 	struct list_head list;
 	struct list_head cb_list;
 	unsigned int should_sort;
+	unsigned int count;
 };
+#define BLK_MAX_REQUEST_COUNT 16
+
 struct blk_plug_cb {
 	struct list_head list;
 	void (*callback)(struct blk_plug_cb *);
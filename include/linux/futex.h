@@ -3,6 +3,7 @@
 
 #include <linux/compiler.h>
 #include <linux/types.h>
+#include <linux/errno.h>
 
 /* Second argument to futex syscall */
 
@@ -173,10 +174,15 @@ union futex_key {
 
 #define FUTEX_KEY_INIT (union futex_key) { .both = { .ptr = NULL } }
 
+struct futex_private_hash;
+
 #ifdef CONFIG_FUTEX
 extern void exit_robust_list(struct task_struct *curr);
 extern void exit_pi_state_list(struct task_struct *curr);
 extern int futex_cmpxchg_enabled;
+extern int futex_hash_prctl(unsigned long cmd, unsigned long arg3,
+			    unsigned long arg4, unsigned long arg5);
+extern void futex_private_hash_free(struct futex_private_hash *ph);
 #else
 static inline void exit_robust_list(struct task_struct *curr)
 {
@@ -184,6 +190,11 @@ static inline void exit_robust_list(struct task_struct *curr)
 static inline void exit_pi_state_list(struct task_struct *curr)
 {
 }
+static inline int futex_hash_prctl(unsigned long cmd, unsigned long arg3,
+				   unsigned long arg4, unsigned long arg5)
+{
+	return -EINVAL;
+}
 #endif
 #endif /* __KERNEL__ */
 
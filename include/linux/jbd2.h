@@ -130,6 +130,7 @@ typedef struct journal_s	journal_t;	/* Journal control structure */
 #define JBD2_SUPERBLOCK_V1	3
 #define JBD2_SUPERBLOCK_V2	4
 #define JBD2_REVOKE_BLOCK	5
+#define JBD2_FC_BLOCK		6
 
 /*
  * Standard header for all descriptor blocks:
@@ -192,6 +193,19 @@ typedef struct jbd2_journal_revoke_header_s
 	__be32		 r_count;	/* Count of bytes used in the block */
 } jbd2_journal_revoke_header_t;
 
+/*
+ * The fast commit block: a snapshot of filesystem state logged for an
+ * fsync without committing the running transaction.  It carries the
+ * sequence number of that transaction and is written just before the
+ * blocks of its commit.  The payload is interpreted by the filesystem.
+ */
+typedef struct jbd2_journal_fc_header_s
+{
+	journal_header_t h_header;
+	__be32		 h_len;		/* bytes of payload that follow */
+	__be32		 h_chksum;	/* crc32_be of header and payload */
+} jbd2_journal_fc_header_t;
+
 
 /* Definitions for the journal tag flags word: */
 #define JBD2_FLAG_ESCAPE		1	/* on-disk block is escaped */
@@ -263,13 +277,15 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_REVOKE		0x00000001
 #define JBD2_FEATURE_INCOMPAT_64BIT		0x00000002
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x80000000
 
 /* Features known to this kernel version: */
 #define JBD2_KNOWN_COMPAT_FEATURES	JBD2_FEATURE_COMPAT_CHECKSUM
 #define JBD2_KNOWN_ROCOMPAT_FEATURES	0
 #define JBD2_KNOWN_INCOMPAT_FEATURES	(JBD2_FEATURE_INCOMPAT_REVOKE | \
 					JBD2_FEATURE_INCOMPAT_64BIT | \
-					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)
+					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -541,6 +557,13 @@ struct transaction_s
 	 */
 	unsigned long		t_log_start;
 
+	/*
+	 * Fast commit blocks logged for this transaction and where in the
+	 * log the first one is [j_state_lock]
+	 */
+	int			t_fc_blocks;
+	unsigned long		t_fc_start;
+
 	/* Number of buffers on the t_buffers list [j_list_lock] */
 	int			t_nr_buffers;
 
@@ -829,6 +852,9 @@ struct journal_s
 	/* Wait queue for waiting for commit to complete */
 	wait_queue_head_t	j_wait_done_commit;
 
+	/* Wait queue for waiting for a fast commit to complete */
+	wait_queue_head_t	j_wait_fc;
+
 	/* Wait queue to trigger checkpointing */
 	wait_queue_head_t	j_wait_checkpoint;
 
@@ -987,6 +1013,13 @@ struct journal_s
 	void			(*j_commit_callback)(journal_t *,
 						     transaction_t *);
 
+	/* Replays the payload of a fast commit block during recovery */
+	int			(*j_fc_replay)(journal_t *, const void *,
+					       unsigned int);
+
+	/* Number of fast commits written [j_state_lock] */
+	unsigned long		j_fc_count;
+
 	/*
 	 * Journal statistics
 	 */
@@ -1016,6 +1049,8 @@ struct journal_s
 #define JBD2_ABORT_ON_SYNCDATA_ERR	0x040	/* Abort the journal on file
 						 * data write error in ordered
 						 * mode */
+#define JBD2_FAST_COMMIT_ONGOING	0x080	/* A fast commit is being
+						 * written, commits wait */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1228,6 +1263,9 @@ int __jbd2_log_start_commit(journal_t *journal, tid_t tid);
 int jbd2_journal_start_commit(journal_t *journal, tid_t *tid);
 int jbd2_journal_force_commit_nested(journal_t *journal);
 int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
+int jbd2_fc_commit(journal_t *journal, tid_t tid, const void *data,
+		   unsigned int len);
+__u32 jbd2_fc_chksum(jbd2_journal_fc_header_t *fc);
 int jbd2_log_do_checkpoint(journal_t *journal);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
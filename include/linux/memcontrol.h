@@ -26,6 +26,10 @@ struct mem_cgroup;
 struct page_cgroup;
 struct page;
 struct mm_struct;
+struct task_struct;
+
+/* Max number of per group lowmemorykiller minfree levels */
+#define MEM_CGROUP_LMK_LEVELS	6
 
 /* Stats that can be updated by kernel. */
 enum mem_cgroup_page_stat_item {
@@ -153,6 +157,12 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 u64 mem_cgroup_get_limit(struct mem_cgroup *mem);
 
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx);
+
+void mem_cgroup_account_reclaim(struct mem_cgroup *mem,
+				unsigned long scanned, unsigned long reclaimed);
+void mem_cgroup_reclaim_priority(struct mem_cgroup *mem, int priority);
+bool mem_cgroup_lmk_enabled(void);
+int mem_cgroup_lmk_minfree(struct task_struct *p, size_t *minfree, int size);
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 void mem_cgroup_split_huge_fixup(struct page *head, struct page *tail);
 #endif
@@ -370,6 +380,28 @@ static inline
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx)
 {
 }
+
+static inline void mem_cgroup_account_reclaim(struct mem_cgroup *mem,
+					      unsigned long scanned,
+					      unsigned long reclaimed)
+{
+}
+
+static inline void mem_cgroup_reclaim_priority(struct mem_cgroup *mem,
+					       int priority)
+{
+}
+
+static inline bool mem_cgroup_lmk_enabled(void)
+{
+	return false;
+}
+
+static inline int mem_cgroup_lmk_minfree(struct task_struct *p,
+					 size_t *minfree, int size)
+{
+	return 0;
+}
 #endif /* CONFIG_CGROUP_MEM_CONT */
 
 #if !defined(CONFIG_CGROUP_MEM_RES_CTLR) || !defined(CONFIG_DEBUG_VM)
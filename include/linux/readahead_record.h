@@ -0,0 +1,28 @@
+#ifndef _LINUX_READAHEAD_RECORD_H
+#define _LINUX_READAHEAD_RECORD_H
+
+#include <linux/fs.h>
+
+/*
+ * Recording of page cache misses, to be replayed as readahead early in
+ * the next boot.  See Documentation/vm/readahead-record.txt
+ */
+#ifdef CONFIG_READAHEAD_RECORD
+extern int readahead_recording;
+extern void __readahead_record(struct file *filp, pgoff_t index,
+			       unsigned long nr);
+
+static inline void readahead_record(struct file *filp, pgoff_t index,
+				    unsigned long nr)
+{
+	if (unlikely(readahead_recording) && filp)
+		__readahead_record(filp, index, nr);
+}
+#else
+static inline void readahead_record(struct file *filp, pgoff_t index,
+				    unsigned long nr)
+{
+}
+#endif
+
+#endif /* _LINUX_READAHEAD_RECORD_H */
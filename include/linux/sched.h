@@ -1179,6 +1179,12 @@ struct sched_entity {
 
 	u64			nr_migrations;
 
+	/* run/wakeup-period averages used for small task packing */
+	u64			last_wakeup;
+	u64			wakeup_sum_exec;
+	u64			avg_run;
+	u64			avg_period;
+
 #ifdef CONFIG_SCHEDSTATS
 	struct sched_statistics statistics;
 #endif
@@ -1526,6 +1532,14 @@ struct task_struct {
 	int make_it_fail;
 #endif
 	struct prop_local_single dirties;
+	/*
+	 * when (nr_dirtied >= nr_dirtied_pause), it's time to call
+	 * balance_dirty_pages() for some dirty throttling pause
+	 */
+	int nr_dirtied;
+	int nr_dirtied_pause;
+	unsigned long dirty_paused_when; /* start of a write-and-pause period */
+
 #ifdef CONFIG_LATENCYTOP
 	int latency_record_count;
 	struct latency_record latency_record[LT_SAVECOUNT];
@@ -1967,6 +1981,7 @@ extern unsigned int sysctl_sched_latency;
 extern unsigned int sysctl_sched_min_granularity;
 extern unsigned int sysctl_sched_wakeup_granularity;
 extern unsigned int sysctl_sched_child_runs_first;
+extern unsigned int sysctl_sched_small_task_pct;
 
 enum sched_tunable_scaling {
 	SCHED_TUNABLESCALING_NONE,
@@ -238,8 +238,6 @@ extern int timer_stats_active;
 
 #define TIMER_STATS_FLAG_DEFERRABLE	0x1
 
-extern void init_timer_stats(void);
-
 extern void timer_stats_update_stats(void *timer, pid_t pid, void *startf,
 				     void *timerf, char *comm,
 				     unsigned int timer_flag);
@@ -259,10 +257,6 @@ static inline void timer_stats_timer_clear_start_info(struct timer_list *timer)
 	timer->start_site = NULL;
 }
 #else
-static inline void init_timer_stats(void)
-{
-}
-
 static inline void timer_stats_timer_set_start_info(struct timer_list *timer)
 {
 }
@@ -59,6 +59,9 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/vmalloc.h>
+#include <linux/prctl.h>
 
 #include <asm/futex.h>
 
@@ -66,8 +69,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Futex flags used to encode options to functions and preserve them across
  * restarts.
@@ -145,19 +146,119 @@ static const struct futex_q futex_q_init = {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The system wide hash table, sized at boot for the number of CPUs
+ * (see futex_init()), so that unrelated futexes rarely share a bucket.
+ */
+static unsigned long __read_mostly futex_hashsize;
+static struct futex_hash_bucket *futex_queues;
+
+/*
+ * A process may have a hash table of its own for its private futexes,
+ * set up with prctl(PR_FUTEX_HASH) while it is still single threaded.
+ * It lives as long as the mm.
+ */
+struct futex_private_hash {
+	unsigned long hashsize;
+	struct futex_hash_bucket queues[0];
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+#define FUTEX_PRIVATE_HASH_MAX	(1UL << 16)
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
+	struct futex_private_hash *ph;
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	if (!(key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED))) {
+		ph = key->private.mm->futex_phash;
+		if (ph)
+			return &ph->queues[hash & (ph->hashsize - 1)];
+	}
+	return &futex_queues[hash & (futex_hashsize - 1)];
+}
+
+static void futex_hash_init(struct futex_hash_bucket *queues,
+			    unsigned long hashsize)
+{
+	unsigned long i;
+
+	for (i = 0; i < hashsize; i++) {
+		plist_head_init(&queues[i].chain);
+		spin_lock_init(&queues[i].lock);
+	}
+}
+
+void futex_private_hash_free(struct futex_private_hash *ph)
+{
+	if (is_vmalloc_addr(ph))
+		vfree(ph);
+	else
+		kfree(ph);
+}
+
+/*
+ * Give the current process a private futex hash table of @slots buckets.
+ * No futex of the process may be hashed yet, which holds as long as the
+ * caller is its only thread.
+ */
+static int futex_private_hash_alloc(unsigned long slots)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_private_hash *ph;
+	size_t size;
+
+	if (!mm || slots < 2 || slots > FUTEX_PRIVATE_HASH_MAX ||
+	    !is_power_of_2(slots))
+		return -EINVAL;
+
+	size = sizeof(*ph) + slots * sizeof(struct futex_hash_bucket);
+	if (size <= PAGE_SIZE)
+		ph = kzalloc(size, GFP_KERNEL);
+	else
+		ph = vzalloc(size);
+	if (!ph)
+		return -ENOMEM;
+	ph->hashsize = slots;
+	futex_hash_init(ph->queues, slots);
+
+	down_write(&mm->mmap_sem);
+	if (mm->futex_phash || atomic_read(&mm->mm_users) != 1) {
+		up_write(&mm->mmap_sem);
+		futex_private_hash_free(ph);
+		return -EBUSY;
+	}
+	mm->futex_phash = ph;
+	up_write(&mm->mmap_sem);
+
+	return 0;
+}
+
+int futex_hash_prctl(unsigned long cmd, unsigned long arg3,
+		     unsigned long arg4, unsigned long arg5)
+{
+	struct futex_private_hash *ph;
+
+	if (arg4 | arg5)
+		return -EINVAL;
+
+	switch (cmd) {
+	case PR_FUTEX_HASH_SET_SLOTS:
+		return futex_private_hash_alloc(arg3);
+	case PR_FUTEX_HASH_GET_SLOTS:
+		if (arg3)
+			return -EINVAL;
+		ph = current->mm ? current->mm->futex_phash : NULL;
+		return ph ? ph->hashsize : 0;
+	}
+	return -EINVAL;
 }
 
 /*
@@ -2710,8 +2811,14 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
 	u32 curval;
-	int i;
+
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2726,10 +2833,11 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       &futex_shift, NULL, 0);
+	futex_hashsize = 1UL << futex_shift;
+	futex_hash_init(futex_queues, futex_hashsize);
 
 	return 0;
 }
@@ -2807,6 +2807,10 @@ static void __sched_fork(struct task_struct *p)
 	p->se.prev_sum_exec_runtime	= 0;
 	p->se.nr_migrations		= 0;
 	p->se.vruntime			= 0;
+	p->se.last_wakeup		= 0;
+	p->se.wakeup_sum_exec		= 0;
+	p->se.avg_run			= 0;
+	p->se.avg_period		= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
 #ifdef CONFIG_SCHEDSTATS
@@ -422,6 +422,8 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	PN(se.exec_start);
 	PN(se.vruntime);
 	PN(se.sum_exec_runtime);
+	PN(se.avg_run);
+	PN(se.avg_period);
 
 	nr_switches = p->nvcsw + p->nivcsw;
 
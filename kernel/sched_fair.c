@@ -89,6 +89,13 @@ const_debug unsigned int sysctl_sched_migration_cost = 500000UL;
  */
 unsigned int __read_mostly sysctl_sched_shares_window = 10000000UL;
 
+/*
+ * Tasks running less than this percentage of their wakeup period are
+ * packed onto busy cpus on wakeup (see SMALL_TASK_PACKING).
+ * (default: 0, packing disabled)
+ */
+unsigned int __read_mostly sysctl_sched_small_task_pct;
+
 static const struct sched_class fair_sched_class;
 
 /**************************************************************
@@ -969,6 +976,40 @@ place_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int initial)
 	se->vruntime = vruntime;
 }
 
+/*
+ * Track the average runtime per activation and the average time between
+ * two wakeups of a task; their ratio is the task's utilization as used by
+ * the small task packing logic.
+ */
+static inline void update_avg_sample(u64 *avg, u64 sample)
+{
+	s64 diff = sample - *avg;
+	*avg += diff >> 3;
+}
+
+static void update_wakeup_stats(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	u64 now = rq_of(cfs_rq)->clock_task;
+
+	if (!entity_is_task(se))
+		return;
+
+	if (se->last_wakeup && (s64)(now - se->last_wakeup) > 0)
+		update_avg_sample(&se->avg_period, now - se->last_wakeup);
+
+	se->last_wakeup = now;
+	se->wakeup_sum_exec = se->sum_exec_runtime;
+}
+
+static void update_sleep_stats(struct sched_entity *se)
+{
+	if (!entity_is_task(se) || !se->last_wakeup)
+		return;
+
+	update_avg_sample(&se->avg_run,
+			  se->sum_exec_runtime - se->wakeup_sum_exec);
+}
+
 static void
 enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 {
@@ -990,6 +1031,7 @@ enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 	if (flags & ENQUEUE_WAKEUP) {
 		place_entity(cfs_rq, se, 0);
 		enqueue_sleeper(cfs_rq, se);
+		update_wakeup_stats(cfs_rq, se);
 	}
 
 	update_stats_enqueue(cfs_rq, se);
@@ -1057,6 +1099,7 @@ dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 
 	update_stats_dequeue(cfs_rq, se);
 	if (flags & DEQUEUE_SLEEP) {
+		update_sleep_stats(se);
 #ifdef CONFIG_SCHEDSTATS
 		if (entity_is_task(se)) {
 			struct task_struct *tsk = task_of(se);
@@ -1675,6 +1718,82 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	return target;
 }
 
+/*
+ * A task is small when it ran less than sysctl_sched_small_task_pct
+ * percent of its average wakeup period. Tasks without any wakeup
+ * history are never considered small.
+ */
+static inline int task_is_small(struct task_struct *p)
+{
+	u64 period = p->se.avg_period;
+
+	if (!sysctl_sched_small_task_pct || !period)
+		return 0;
+
+	return p->se.avg_run * 100 < period * sysctl_sched_small_task_pct;
+}
+
+/*
+ * A busy cpu can take a small task when it only runs fair tasks and
+ * is not running more tasks than its capacity (at least one), so the
+ * packed small task may take it at most one task over its capacity.
+ */
+static inline int cpu_can_pack(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long capacity;
+
+	if (idle_cpu(cpu) || rq->nr_running != rq->cfs.nr_running)
+		return 0;
+
+	capacity = DIV_ROUND_CLOSEST(power_of(cpu), SCHED_POWER_SCALE);
+
+	return rq->nr_running <= max(capacity, 1UL);
+}
+
+/*
+ * Try and locate a busy CPU in the sched_domain that can absorb a small
+ * task, so that the idle CPUs are left alone. Returns -1 if there is none.
+ */
+static int select_packing_cpu(struct task_struct *p, int target)
+{
+	int prev_cpu = task_cpu(p);
+	struct sched_domain *sd;
+	int i, best = -1;
+	unsigned long load, min_load = ULONG_MAX;
+
+	if (cpu_can_pack(target))
+		return target;
+
+	if (prev_cpu != target &&
+	    cpumask_test_cpu(prev_cpu, &p->cpus_allowed) &&
+	    cpu_can_pack(prev_cpu))
+		return prev_cpu;
+
+	rcu_read_lock();
+	for_each_domain(target, sd) {
+		if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
+			break;
+
+		for_each_cpu_and(i, sched_domain_span(sd), &p->cpus_allowed) {
+			if (!cpu_can_pack(i))
+				continue;
+
+			load = weighted_cpuload(i);
+			if (load < min_load) {
+				min_load = load;
+				best = i;
+			}
+		}
+
+		if (best != -1)
+			break;
+	}
+	rcu_read_unlock();
+
+	return best;
+}
+
 /*
  * sched_balance_self: balance the current task (running on cpu) in domains
  * that have the 'flag' flag set. In practice, this is SD_BALANCE_FORK and
@@ -1756,6 +1875,12 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 		if (cpu == prev_cpu || wake_affine(affine_sd, p, sync))
 			prev_cpu = cpu;
 
+		if (sched_feat(SMALL_TASK_PACKING) && task_is_small(p)) {
+			new_cpu = select_packing_cpu(p, prev_cpu);
+			if (new_cpu != -1)
+				goto unlock;
+		}
+
 		new_cpu = select_idle_sibling(p, prev_cpu);
 		goto unlock;
 	}
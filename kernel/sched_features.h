@@ -24,6 +24,14 @@ SCHED_FEAT(WAKEUP_PREEMPT, 1)
  */
 SCHED_FEAT(AFFINE_WAKEUPS, 1)
 
+/*
+ * Wake tasks whose utilization is below sysctl_sched_small_task_pct
+ * onto an already busy cpu that shares package resources, instead of
+ * spreading them to idle siblings, so the idle cpus can stay in their
+ * deep power states.
+ */
+SCHED_FEAT(SMALL_TASK_PACKING, 1)
+
 /*
  * Prefer to schedule the task we woke last (assuming it failed
  * wakeup-preemption), since its likely going to consume data we
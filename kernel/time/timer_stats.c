@@ -10,9 +10,10 @@
  * Con Kolivas dyntick patch set. It was developed by Daniel Petrini at the
  * Instituto Nokia de Tecnologia - INdT - Manaus. timer_top's design was based
  * on dynamic allocation of the statistics entries and linear search based
- * lookup combined with a global lock, rather than the static array, hash
- * and per-CPU locking which is used by timer_stats. It was written for the
- * pre hrtimer kernel code and therefore did not take hrtimers into account.
+ * lookup combined with a global lock, rather than the per-CPU arrays and
+ * hashes with lockless collection which are used by timer_stats. It was
+ * written for the pre hrtimer kernel code and therefore did not take
+ * hrtimers into account.
  * Nevertheless it provided the base for the timer_stats implementation and
  * was a helpful source of inspiration. Kudos to Daniel and the Nokia folks
  * for this effort.
@@ -42,6 +43,8 @@
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/kallsyms.h>
+#include <linux/rcupdate.h>
+#include <linux/vmalloc.h>
 
 #include <asm/uaccess.h>
 
@@ -75,18 +78,7 @@ struct entry {
 	 * this information past task exit:
 	 */
 	char			comm[TASK_COMM_LEN + 1];
-
-} ____cacheline_aligned_in_smp;
-
-/*
- * Spinlock protecting the tables - not taken during lookup:
- */
-static DEFINE_SPINLOCK(table_lock);
-
-/*
- * Per-CPU lookup locks for fast hash lookup:
- */
-static DEFINE_PER_CPU(raw_spinlock_t, tstats_lookup_lock);
+};
 
 /*
  * Mutex to serialize state changes with show-stats activities:
@@ -113,11 +105,6 @@ static ktime_t time_start, time_stop;
 #define MAX_ENTRIES_BITS	10
 #define MAX_ENTRIES		(1UL << MAX_ENTRIES_BITS)
 
-static unsigned long nr_entries;
-static struct entry entries[MAX_ENTRIES];
-
-static atomic_t overflow_count;
-
 /*
  * The entries are in a hash-table, for fast lookup:
  */
@@ -131,24 +118,69 @@ static atomic_t overflow_count;
 	  (unsigned long)(entry)->expire_func ^				\
 	  (unsigned long)(entry)->pid		) & TSTAT_HASH_MASK)
 
-#define tstat_hashentry(entry)	(tstat_hash_table + __tstat_hashfn(entry))
+#define tstat_hashentry(table, entry)	\
+	((table)->hash + __tstat_hashfn(entry))
 
-static struct entry *tstat_hash_table[TSTAT_HASH_SIZE] __read_mostly;
+/*
+ * A table of entries. Every CPU collects into its own table with
+ * interrupts disabled and without taking any lock; the per-CPU tables
+ * are only merged into merged_table when /proc/timer_stats is read.
+ *
+ * Entries are only ever appended while collection is active, and
+ * nr_entries is published after the entry is set up, so a reader on
+ * another CPU can walk entries[0..nr_entries) without synchronizing
+ * with the owning CPU. The counters it reads may be slightly stale.
+ */
+struct tstat_table {
+	unsigned long		nr_entries;
+	unsigned long		overflow_count;
+	struct entry		*hash[TSTAT_HASH_SIZE];
+	struct entry		entries[MAX_ENTRIES];
+};
+
+static DEFINE_PER_CPU(struct tstat_table *, tstat_tables);
+
+/*
+ * Result of the merge, protected by show_mutex:
+ */
+static struct tstat_table merged_table;
+
+static void reset_table(struct tstat_table *table)
+{
+	table->nr_entries = 0;
+	table->overflow_count = 0;
+	memset(table->hash, 0, sizeof(table->hash));
+}
 
 static void reset_entries(void)
 {
-	nr_entries = 0;
-	memset(entries, 0, sizeof(entries));
-	memset(tstat_hash_table, 0, sizeof(tstat_hash_table));
-	atomic_set(&overflow_count, 0);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		reset_table(per_cpu(tstat_tables, cpu));
 }
 
-static struct entry *alloc_entry(void)
+/*
+ * The per-CPU tables are allocated when collection is first enabled
+ * and kept around afterwards. Called with show_mutex held.
+ */
+static int alloc_tables(void)
 {
-	if (nr_entries >= MAX_ENTRIES)
-		return NULL;
+	struct tstat_table *table;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (per_cpu(tstat_tables, cpu))
+			continue;
+
+		table = vzalloc_node(sizeof(*table), cpu_to_node(cpu));
+		if (!table)
+			return -ENOMEM;
 
-	return entries + nr_entries++;
+		per_cpu(tstat_tables, cpu) = table;
+	}
+
+	return 0;
 }
 
 static int match_entries(struct entry *entry1, struct entry *entry2)
@@ -160,62 +192,36 @@ static int match_entries(struct entry *entry1, struct entry *entry2)
 }
 
 /*
- * Look up whether an entry matching this item is present
- * in the hash already. Must be called with irqs off and the
- * lookup lock held:
+ * Look up whether an entry matching this item is present in the
+ * table already, and allocate and link a new one if it is not.
+ * The table must only be modified by one context at a time: the
+ * owning CPU with irqs off, or the merge code under show_mutex.
  */
-static struct entry *tstat_lookup(struct entry *entry, char *comm)
+static struct entry *
+tstat_lookup(struct tstat_table *table, struct entry *entry, char *comm)
 {
-	struct entry **head, *curr, *prev;
+	struct entry **head, *curr;
 
-	head = tstat_hashentry(entry);
-	curr = *head;
+	head = tstat_hashentry(table, entry);
 
-	/*
-	 * The fastpath is when the entry is already hashed,
-	 * we do this with the lookup lock held, but with the
-	 * table lock not held:
-	 */
-	while (curr) {
+	for (curr = *head; curr; curr = curr->next) {
 		if (match_entries(curr, entry))
 			return curr;
-
-		curr = curr->next;
 	}
-	/*
-	 * Slowpath: allocate, set up and link a new hash entry:
-	 */
-	prev = NULL;
-	curr = *head;
 
-	spin_lock(&table_lock);
-	/*
-	 * Make sure we have not raced with another CPU:
-	 */
-	while (curr) {
-		if (match_entries(curr, entry))
-			goto out_unlock;
-
-		prev = curr;
-		curr = curr->next;
-	}
+	if (table->nr_entries >= MAX_ENTRIES)
+		return NULL;
 
-	curr = alloc_entry();
-	if (curr) {
-		*curr = *entry;
-		curr->count = 0;
-		curr->next = NULL;
-		memcpy(curr->comm, comm, TASK_COMM_LEN);
+	curr = table->entries + table->nr_entries;
+	*curr = *entry;
+	curr->count = 0;
+	curr->next = *head;
+	memcpy(curr->comm, comm, TASK_COMM_LEN);
 
-		smp_mb(); /* Ensure that curr is initialized before insert */
+	smp_wmb(); /* Ensure that curr is initialized before publishing it */
 
-		if (prev)
-			prev->next = curr;
-		else
-			*head = curr;
-	}
- out_unlock:
-	spin_unlock(&table_lock);
+	*head = curr;
+	table->nr_entries++;
 
 	return curr;
 }
@@ -235,36 +241,74 @@ void timer_stats_update_stats(void *timer, pid_t pid, void *startf,
 			      void *timerf, char *comm,
 			      unsigned int timer_flag)
 {
-	/*
-	 * It doesn't matter which lock we take:
-	 */
-	raw_spinlock_t *lock;
+	struct tstat_table *table;
 	struct entry *entry, input;
 	unsigned long flags;
 
 	if (likely(!timer_stats_active))
 		return;
 
-	lock = &per_cpu(tstats_lookup_lock, raw_smp_processor_id());
-
 	input.timer = timer;
 	input.start_func = startf;
 	input.expire_func = timerf;
 	input.pid = pid;
 	input.timer_flag = timer_flag;
 
-	raw_spin_lock_irqsave(lock, flags);
+	/*
+	 * Irqs off is all the protection the local table needs, and it
+	 * also lets sync_access() wait for us with synchronize_sched():
+	 */
+	local_irq_save(flags);
 	if (!timer_stats_active)
-		goto out_unlock;
+		goto out;
+
+	table = __this_cpu_read(tstat_tables);
 
-	entry = tstat_lookup(&input, comm);
+	entry = tstat_lookup(table, &input, comm);
 	if (likely(entry))
 		entry->count++;
 	else
-		atomic_inc(&overflow_count);
+		table->overflow_count++;
+
+ out:
+	local_irq_restore(flags);
+}
+
+/*
+ * Fold all per-CPU tables into merged_table. Called with show_mutex
+ * held, concurrently with collection on the other CPUs.
+ */
+static void merge_tables(void)
+{
+	struct tstat_table *table;
+	struct entry *entry, *merged;
+	unsigned long i, nr;
+	int cpu;
 
- out_unlock:
-	raw_spin_unlock_irqrestore(lock, flags);
+	reset_table(&merged_table);
+
+	for_each_possible_cpu(cpu) {
+		table = per_cpu(tstat_tables, cpu);
+		if (!table)
+			continue;
+
+		nr = ACCESS_ONCE(table->nr_entries);
+		smp_rmb(); /* Pairs with the smp_wmb() in tstat_lookup() */
+
+		merged_table.overflow_count +=
+			ACCESS_ONCE(table->overflow_count);
+
+		for (i = 0; i < nr; i++) {
+			entry = table->entries + i;
+
+			merged = tstat_lookup(&merged_table, entry,
+					      entry->comm);
+			if (merged)
+				merged->count += ACCESS_ONCE(entry->count);
+			else
+				merged_table.overflow_count++;
+		}
+	}
 }
 
 static void print_name_offset(struct seq_file *m, unsigned long addr)
@@ -298,14 +342,16 @@ static int tstats_show(struct seq_file *m, void *v)
 	period = ktime_to_timespec(time);
 	ms = period.tv_nsec / 1000000;
 
+	merge_tables();
+
 	seq_puts(m, "Timer Stats Version: v0.2\n");
 	seq_printf(m, "Sample period: %ld.%03ld s\n", period.tv_sec, ms);
-	if (atomic_read(&overflow_count))
-		seq_printf(m, "Overflow: %d entries\n",
-			atomic_read(&overflow_count));
+	if (merged_table.overflow_count)
+		seq_printf(m, "Overflow: %lu entries\n",
+			merged_table.overflow_count);
 
-	for (i = 0; i < nr_entries; i++) {
-		entry = entries + i;
+	for (i = 0; i < merged_table.nr_entries; i++) {
+		entry = merged_table.entries + i;
  		if (entry->timer_flag & TIMER_STATS_FLAG_DEFERRABLE) {
 			seq_printf(m, "%4luD, %5d %-16s ",
 				entry->count, entry->pid, entry->comm);
@@ -340,20 +386,12 @@ static int tstats_show(struct seq_file *m, void *v)
 
 /*
  * After a state change, make sure all concurrent lookup/update
- * activities have stopped:
+ * activities have stopped. Updates run with irqs disabled, so a
+ * sched RCU grace period covers all of them:
  */
 static void sync_access(void)
 {
-	unsigned long flags;
-	int cpu;
-
-	for_each_online_cpu(cpu) {
-		raw_spinlock_t *lock = &per_cpu(tstats_lookup_lock, cpu);
-
-		raw_spin_lock_irqsave(lock, flags);
-		/* nothing */
-		raw_spin_unlock_irqrestore(lock, flags);
-	}
+	synchronize_sched();
 }
 
 static ssize_t tstats_write(struct file *file, const char __user *buf,
@@ -378,6 +416,10 @@ static ssize_t tstats_write(struct file *file, const char __user *buf,
 		break;
 	case '1':
 		if (!timer_stats_active) {
+			if (alloc_tables()) {
+				count = -ENOMEM;
+				break;
+			}
 			reset_entries();
 			time_start = ktime_get();
 			smp_mb();
@@ -405,14 +447,6 @@ static const struct file_operations tstats_fops = {
 	.release	= single_release,
 };
 
-void __init init_timer_stats(void)
-{
-	int cpu;
-
-	for_each_possible_cpu(cpu)
-		raw_spin_lock_init(&per_cpu(tstats_lookup_lock, cpu));
-}
-
 static int __init init_tstats_procfs(void)
 {
 	struct proc_dir_entry *pe;
@@ -35,6 +35,8 @@
 #include <linux/memcontrol.h>
 #include <linux/mm_inline.h> /* for page_is_file_cache() */
 #include <linux/cleancache.h>
+#include <linux/ksm.h>
+#include <linux/readahead_record.h>
 #include "internal.h"
 
 /*
@@ -448,6 +450,130 @@ int replace_page_cache_page(struct page *old, struct page *new, gfp_t gfp_mask)
 }
 EXPORT_SYMBOL_GPL(replace_page_cache_page);
 
+/*
+ * Whether the buffers ->write_begin() attached to @page can be moved to
+ * another page: the filesystem must be one whose pages buffer_migrate_page()
+ * may move, and no one may be using the buffers.
+ */
+static int page_buffers_movable(struct page *page)
+{
+#ifdef CONFIG_MIGRATION
+	struct buffer_head *bh, *head;
+
+	if (!page_has_buffers(page) || PagePrivate2(page) ||
+	    page->mapping->a_ops->migratepage != buffer_migrate_page)
+		return 0;
+
+	bh = head = page_buffers(page);
+	do {
+		if (atomic_read(&bh->b_count) || buffer_locked(bh) ||
+		    buffer_dirty(bh))
+			return 0;
+		bh = bh->b_this_page;
+	} while (bh != head);
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Move the buffers of @old to @page, both locked, as buffer_migrate_page() */
+static void page_move_buffers(struct address_space *mapping,
+			      struct page *old, struct page *page)
+{
+	struct buffer_head *bh, *head;
+
+	spin_lock(&mapping->private_lock);
+	head = page_buffers(old);
+	ClearPagePrivate(old);
+	set_page_private(page, page_private(old));
+	set_page_private(old, 0);
+	put_page(old);
+	get_page(page);
+
+	bh = head;
+	do {
+		set_bh_page(bh, page, bh_offset(bh));
+		bh = bh->b_this_page;
+	} while (bh != head);
+
+	SetPagePrivate(page);
+	spin_unlock(&mapping->private_lock);
+
+	if (PageMappedToDisk(old))
+		SetPageMappedToDisk(page);
+}
+
+/**
+ * replace_page_cache_stolen - put a page taken from its owner in the pagecache
+ * @old:	pagecache page to be replaced
+ * @page:	page to replace it with
+ * @gfp_mask:	allocation mode
+ *
+ * @page must be locked, uptodate and held by no one but the caller: a
+ * page removed from the pagecache of another file, or an anonymous page
+ * given away by vmsplice() and no longer mapped.  It is taken off the
+ * LRU list it was on, cleared of its previous use and takes the place
+ * of @old on the file LRU list.
+ *
+ * @old must be locked and is meant to be the page ->write_begin()
+ * prepared for a write of all of it, so the filesystem has done its
+ * block allocation and accounting before the data is moved in.  Buffer
+ * heads on @old move along to @page when the filesystem lets
+ * buffer_migrate_page() move its pages (so only with CONFIG_MIGRATION);
+ * any other private data makes the move fail.
+ *
+ * Returns -EBUSY when the page cannot be moved.
+ */
+int replace_page_cache_stolen(struct page *old, struct page *page,
+			      gfp_t gfp_mask)
+{
+	struct address_space *mapping = old->mapping;
+	int was_lru = 0;
+	int error;
+
+	VM_BUG_ON(!PageLocked(old));
+	VM_BUG_ON(!PageLocked(page));
+
+	/* shmem keeps its own accounting of the pages of a file */
+	if (!mapping || mapping_cap_swap_backed(mapping) ||
+	    page_mapped(old) || PageDirty(old) || PageWriteback(old) ||
+	    PageMlocked(old) ||
+	    (page_has_private(old) && !page_buffers_movable(old)))
+		return -EBUSY;
+
+	if (page_count(page) != 1 || page_mapped(page) ||
+	    (page->mapping && !PageAnon(page)) || !PageUptodate(page) ||
+	    PageCompound(page) || PageKsm(page) || PageSwapCache(page) ||
+	    PageWriteback(page) || PageMlocked(page) ||
+	    PageUnevictable(page) || page_has_private(page))
+		return -EBUSY;
+
+	if (PageLRU(page)) {
+		if (isolate_lru_page(page))
+			return -EBUSY;
+		was_lru = 1;
+	}
+
+	page->mapping = NULL;
+	ClearPageActive(page);
+	ClearPageDirty(page);
+	ClearPageReclaim(page);
+	ClearPageMappedToDisk(page);
+	ClearPageSwapBacked(page);
+
+	error = replace_page_cache_page(old, page, gfp_mask);
+	if (!error && page_has_buffers(old))
+		page_move_buffers(mapping, old, page);
+	if (!error || was_lru)
+		lru_cache_add_file(page);
+	if (was_lru)
+		put_page(page);
+	return error;
+}
+EXPORT_SYMBOL_GPL(replace_page_cache_stolen);
+
 /**
  * add_to_page_cache_locked - add a locked page to the pagecache
  * @page:	page to add
@@ -1708,6 +1834,7 @@ no_cached_page:
 	 * We're only likely to ever get here if MADV_RANDOM is in
 	 * effect.
 	 */
+	readahead_record(file, offset, 1);
 	error = page_cache_read(file, offset);
 
 	/*
@@ -1752,8 +1879,77 @@ page_not_uptodate:
 }
 EXPORT_SYMBOL(filemap_fault);
 
+/**
+ * filemap_map_pages - map the cached pages around a read fault
+ * @vma:	vma in which the fault was taken
+ * @vmf:	pages from @vmf->pgoff to @vmf->max_pgoff, with @vmf->pte
+ *		the pte of @vmf->pgoff
+ *
+ * Maps each page of the range that is uptodate in the page cache and
+ * can be locked without waiting.  Pages marked for readahead are left
+ * to filemap_fault() so that the next readahead is started.  Called
+ * with the page table lock held, nothing here sleeps or starts I/O.
+ */
+void filemap_map_pages(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct file *file = vma->vm_file;
+	struct address_space *mapping = file->f_mapping;
+	struct file_ra_state *ra = &file->f_ra;
+	struct page *pages[PAGEVEC_SIZE];
+	pgoff_t index = vmf->pgoff;
+	unsigned long address = (unsigned long) vmf->virtual_address;
+	unsigned long addr;
+	pgoff_t size;
+	unsigned int i, nr;
+	pte_t *pte;
+
+	while (index <= vmf->max_pgoff) {
+		nr = find_get_pages(mapping, index,
+				    min_t(unsigned long, PAGEVEC_SIZE,
+					  vmf->max_pgoff - index + 1), pages);
+		if (!nr)
+			break;
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
+
+			index = page->index + 1;
+			if (page->index > vmf->max_pgoff)
+				goto skip;
+			if (!PageUptodate(page) || PageReadahead(page) ||
+			    PageHWPoison(page))
+				goto skip;
+			if (!trylock_page(page))
+				goto skip;
+			if (page->mapping != mapping || !PageUptodate(page))
+				goto unlock;
+
+			size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1)
+				>> PAGE_CACHE_SHIFT;
+			if (page->index >= size)
+				goto unlock;
+
+			pte = vmf->pte + page->index - vmf->pgoff;
+			if (!pte_none(*pte))
+				goto unlock;
+
+			if (ra->mmap_miss > 0)
+				ra->mmap_miss--;
+			addr = address + (page->index - vmf->pgoff) * PAGE_SIZE;
+			do_set_pte(vma, addr, page, pte);
+			unlock_page(page);
+			continue;
+unlock:
+			unlock_page(page);
+skip:
+			page_cache_release(page);
+		}
+	}
+}
+EXPORT_SYMBOL(filemap_map_pages);
+
 const struct vm_operations_struct generic_file_vm_ops = {
 	.fault		= filemap_fault,
+	.map_pages	= filemap_map_pages,
 };
 
 /* This is used for a general mmap of a disk file */
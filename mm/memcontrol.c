@@ -202,8 +202,24 @@ struct mem_cgroup_eventfd_list {
 	struct eventfd_ctx *eventfd;
 };
 
+/* for pressure level notifications */
+enum mem_cgroup_pressure_level {
+	MEM_CGROUP_PRESSURE_NONE,
+	MEM_CGROUP_PRESSURE_LOW,
+	MEM_CGROUP_PRESSURE_MEDIUM,
+	MEM_CGROUP_PRESSURE_CRITICAL,
+	MEM_CGROUP_NR_PRESSURE_LEVELS,
+};
+
+struct mem_cgroup_pressure_event {
+	struct list_head list;
+	struct eventfd_ctx *eventfd;
+	int level;
+};
+
 static void mem_cgroup_threshold(struct mem_cgroup *mem);
 static void mem_cgroup_oom_notify(struct mem_cgroup *mem);
+static void mem_cgroup_pressure_check(struct mem_cgroup *mem);
 
 /*
  * The memory controller data structure. The memory controller controls both
@@ -268,6 +284,23 @@ struct mem_cgroup {
 	/* For oom notifier event fd */
 	struct list_head oom_notify;
 
+	/*
+	 * Reclaim efficiency of the current window and the pressure
+	 * level derived from it, protected by pressure_lock.
+	 */
+	spinlock_t	pressure_lock;
+	unsigned long	pressure_scanned;
+	unsigned long	pressure_reclaimed;
+	int		reclaim_level;
+	unsigned long	reclaim_stamp;
+	int		pressure_level;
+	/* For pressure level notifier event fds */
+	struct list_head pressure_notify;
+
+	/* lowmemorykiller minfree levels of this group, in pages */
+	size_t		lmk_minfree[MEM_CGROUP_LMK_LEVELS];
+	int		lmk_minfree_size;
+
 	/*
 	 * Should we move charges of a task when a task is moved into this
 	 * mem_cgroup ? And what type of charges should we move ?
@@ -706,6 +739,7 @@ static void memcg_check_events(struct mem_cgroup *mem, struct page *page)
 		if (unlikely(__memcg_event_check(mem,
 			     MEM_CGROUP_TARGET_SOFTLIMIT))) {
 			mem_cgroup_update_tree(mem, page);
+			mem_cgroup_pressure_check(mem);
 			__mem_cgroup_target_update(mem,
 						   MEM_CGROUP_TARGET_SOFTLIMIT);
 		}
@@ -4612,6 +4646,354 @@ static void mem_cgroup_oom_unregister_event(struct cgroup *cgrp,
 	mutex_unlock(&memcg_oom_mutex);
 }
 
+/*
+ * Memory pressure of a group is derived from two signals: its usage
+ * above the soft limit, which marks it as the preferred target of global
+ * reclaim, and how hard reclaim from the group has been recently. The
+ * latter is measured over windows of MEM_CGROUP_PRESSURE_WINDOW scanned
+ * pages as the percentage of scanned pages that could not be reclaimed.
+ * A window result stays valid for MEM_CGROUP_PRESSURE_DECAY.
+ */
+#define MEM_CGROUP_PRESSURE_WINDOW	(SWAP_CLUSTER_MAX * 16)
+#define MEM_CGROUP_PRESSURE_DECAY	(HZ)
+#define MEM_CGROUP_PRESSURE_MEDIUM	60
+#define MEM_CGROUP_PRESSURE_CRITICAL	95
+
+/*
+ * Reclaim that had to raise its scan priority to this level without
+ * meeting its target is in trouble regardless of the current window:
+ * it has scanned 1/8th of the LRU lists in a single pass.
+ */
+#define MEM_CGROUP_PRESSURE_CRITICAL_PRIO	3
+
+static const char * const mem_cgroup_pressure_names[] = {
+	[MEM_CGROUP_PRESSURE_NONE]	= "none",
+	[MEM_CGROUP_PRESSURE_LOW]	= "low",
+	[MEM_CGROUP_PRESSURE_MEDIUM]	= "medium",
+	[MEM_CGROUP_PRESSURE_CRITICAL]	= "critical",
+};
+
+/* number of groups with lowmemorykiller minfree levels set */
+static atomic_t mem_cgroup_lmk_groups = ATOMIC_INIT(0);
+
+static int mem_cgroup_reclaim_level(unsigned long scanned,
+				    unsigned long reclaimed)
+{
+	unsigned long missed;
+
+	if (reclaimed >= scanned)
+		return MEM_CGROUP_PRESSURE_NONE;
+
+	missed = (scanned - reclaimed) * 100 / scanned;
+	if (missed >= MEM_CGROUP_PRESSURE_CRITICAL)
+		return MEM_CGROUP_PRESSURE_CRITICAL;
+	if (missed >= MEM_CGROUP_PRESSURE_MEDIUM)
+		return MEM_CGROUP_PRESSURE_MEDIUM;
+	return MEM_CGROUP_PRESSURE_LOW;
+}
+
+/* Called with pressure_lock held */
+static int __mem_cgroup_pressure_level(struct mem_cgroup *mem)
+{
+	int level = MEM_CGROUP_PRESSURE_NONE;
+
+	if (res_counter_soft_limit_excess(&mem->res))
+		level = MEM_CGROUP_PRESSURE_LOW;
+
+	if (mem->reclaim_level > level &&
+	    time_before(jiffies, mem->reclaim_stamp +
+			MEM_CGROUP_PRESSURE_DECAY))
+		level = mem->reclaim_level;
+
+	return level;
+}
+
+/* Called with pressure_lock held */
+static void __mem_cgroup_pressure_notify(struct mem_cgroup *mem, int level)
+{
+	struct mem_cgroup_pressure_event *ev;
+
+	list_for_each_entry(ev, &mem->pressure_notify, list) {
+		if (level >= ev->level)
+			eventfd_signal(ev->eventfd, 1);
+	}
+}
+
+/*
+ * Re-evaluate the pressure level from the charge path and notify the
+ * listeners when it changed.
+ */
+static void mem_cgroup_pressure_check(struct mem_cgroup *mem)
+{
+	unsigned long flags;
+	int level;
+
+	if (list_empty(&mem->pressure_notify))
+		return;
+
+	spin_lock_irqsave(&mem->pressure_lock, flags);
+	level = __mem_cgroup_pressure_level(mem);
+	if (level != mem->pressure_level) {
+		mem->pressure_level = level;
+		if (level != MEM_CGROUP_PRESSURE_NONE)
+			__mem_cgroup_pressure_notify(mem, level);
+	}
+	spin_unlock_irqrestore(&mem->pressure_lock, flags);
+}
+
+/*
+ * Global reclaim is accounted to the root group, whose pressure level
+ * thus reports the pressure of the whole system.
+ */
+static struct mem_cgroup *mem_cgroup_pressure_target(struct mem_cgroup *mem)
+{
+	if (mem_cgroup_disabled())
+		return NULL;
+	return mem ? mem : root_mem_cgroup;
+}
+
+/**
+ * mem_cgroup_account_reclaim - account a reclaim pass against a group
+ * @mem: the group reclaim was targeted at, NULL for global reclaim
+ * @scanned: number of pages scanned in the pass
+ * @reclaimed: number of pages reclaimed in the pass
+ *
+ * Every time a window of scanned pages completes, the pressure level is
+ * recomputed and all listeners registered at or below it are signalled.
+ */
+void mem_cgroup_account_reclaim(struct mem_cgroup *mem,
+				unsigned long scanned, unsigned long reclaimed)
+{
+	unsigned long flags;
+	int level;
+
+	mem = mem_cgroup_pressure_target(mem);
+	if (!mem || !scanned)
+		return;
+
+	spin_lock_irqsave(&mem->pressure_lock, flags);
+	mem->pressure_scanned += scanned;
+	mem->pressure_reclaimed += reclaimed;
+	if (mem->pressure_scanned < MEM_CGROUP_PRESSURE_WINDOW) {
+		spin_unlock_irqrestore(&mem->pressure_lock, flags);
+		return;
+	}
+
+	mem->reclaim_level = mem_cgroup_reclaim_level(mem->pressure_scanned,
+						      mem->pressure_reclaimed);
+	mem->reclaim_stamp = jiffies;
+	mem->pressure_scanned = 0;
+	mem->pressure_reclaimed = 0;
+
+	level = __mem_cgroup_pressure_level(mem);
+	mem->pressure_level = level;
+	if (level != MEM_CGROUP_PRESSURE_NONE)
+		__mem_cgroup_pressure_notify(mem, level);
+	spin_unlock_irqrestore(&mem->pressure_lock, flags);
+}
+
+/**
+ * mem_cgroup_reclaim_priority - report the scan priority of a reclaimer
+ * @mem: the group reclaim is targeted at, NULL for global reclaim
+ * @priority: the priority reclaim is about to scan at
+ *
+ * Reclaim reaching MEM_CGROUP_PRESSURE_CRITICAL_PRIO raises the level to
+ * critical right away, without waiting for the current window to fill up.
+ */
+void mem_cgroup_reclaim_priority(struct mem_cgroup *mem, int priority)
+{
+	unsigned long flags;
+
+	if (priority != MEM_CGROUP_PRESSURE_CRITICAL_PRIO)
+		return;
+
+	mem = mem_cgroup_pressure_target(mem);
+	if (!mem)
+		return;
+
+	spin_lock_irqsave(&mem->pressure_lock, flags);
+	mem->reclaim_level = MEM_CGROUP_PRESSURE_CRITICAL;
+	mem->reclaim_stamp = jiffies;
+	mem->pressure_level = MEM_CGROUP_PRESSURE_CRITICAL;
+	__mem_cgroup_pressure_notify(mem, MEM_CGROUP_PRESSURE_CRITICAL);
+	spin_unlock_irqrestore(&mem->pressure_lock, flags);
+}
+
+static int mem_cgroup_pressure_read(struct cgroup *cgrp, struct cftype *cft,
+				    struct seq_file *m)
+{
+	struct mem_cgroup *mem = mem_cgroup_from_cont(cgrp);
+	unsigned long flags;
+	int level;
+
+	spin_lock_irqsave(&mem->pressure_lock, flags);
+	level = __mem_cgroup_pressure_level(mem);
+	spin_unlock_irqrestore(&mem->pressure_lock, flags);
+
+	seq_printf(m, "%s\n", mem_cgroup_pressure_names[level]);
+	return 0;
+}
+
+static int mem_cgroup_pressure_register_event(struct cgroup *cgrp,
+	struct cftype *cft, struct eventfd_ctx *eventfd, const char *args)
+{
+	struct mem_cgroup *mem = mem_cgroup_from_cont(cgrp);
+	struct mem_cgroup_pressure_event *ev;
+	unsigned long flags;
+	int level;
+
+	for (level = MEM_CGROUP_PRESSURE_LOW;
+	     level < MEM_CGROUP_NR_PRESSURE_LEVELS; level++) {
+		if (!strcmp(args, mem_cgroup_pressure_names[level]))
+			break;
+	}
+	if (level == MEM_CGROUP_NR_PRESSURE_LEVELS)
+		return -EINVAL;
+
+	ev = kmalloc(sizeof(*ev), GFP_KERNEL);
+	if (!ev)
+		return -ENOMEM;
+
+	ev->eventfd = eventfd;
+	ev->level = level;
+
+	spin_lock_irqsave(&mem->pressure_lock, flags);
+	list_add(&ev->list, &mem->pressure_notify);
+	/* already under pressure ? */
+	if (__mem_cgroup_pressure_level(mem) >= level)
+		eventfd_signal(eventfd, 1);
+	spin_unlock_irqrestore(&mem->pressure_lock, flags);
+
+	return 0;
+}
+
+static void mem_cgroup_pressure_unregister_event(struct cgroup *cgrp,
+	struct cftype *cft, struct eventfd_ctx *eventfd)
+{
+	struct mem_cgroup *mem = mem_cgroup_from_cont(cgrp);
+	struct mem_cgroup_pressure_event *ev, *tmp;
+	unsigned long flags;
+	LIST_HEAD(freed);
+
+	spin_lock_irqsave(&mem->pressure_lock, flags);
+	list_for_each_entry_safe(ev, tmp, &mem->pressure_notify, list) {
+		if (ev->eventfd == eventfd)
+			list_move(&ev->list, &freed);
+	}
+	spin_unlock_irqrestore(&mem->pressure_lock, flags);
+
+	list_for_each_entry_safe(ev, tmp, &freed, list)
+		kfree(ev);
+}
+
+/**
+ * mem_cgroup_lmk_enabled - are per group lowmemorykiller levels in use?
+ */
+bool mem_cgroup_lmk_enabled(void)
+{
+	return atomic_read(&mem_cgroup_lmk_groups) > 0;
+}
+EXPORT_SYMBOL(mem_cgroup_lmk_enabled);
+
+/**
+ * mem_cgroup_lmk_minfree - get the lowmemorykiller levels of a task's group
+ * @p: the task
+ * @minfree: array receiving the minfree levels, in pages
+ * @size: size of @minfree
+ *
+ * Returns the number of levels stored in @minfree, 0 if the group of @p
+ * has none set and the global levels apply.
+ */
+int mem_cgroup_lmk_minfree(struct task_struct *p, size_t *minfree, int size)
+{
+	struct mem_cgroup *mem;
+	unsigned long flags;
+	int n = 0;
+
+	rcu_read_lock();
+	mem = mem_cgroup_from_task(p);
+	if (mem && mem->lmk_minfree_size) {
+		spin_lock_irqsave(&mem->pressure_lock, flags);
+		n = min(size, mem->lmk_minfree_size);
+		memcpy(minfree, mem->lmk_minfree, n * sizeof(*minfree));
+		spin_unlock_irqrestore(&mem->pressure_lock, flags);
+	}
+	rcu_read_unlock();
+
+	return n;
+}
+EXPORT_SYMBOL(mem_cgroup_lmk_minfree);
+
+static int mem_cgroup_lmk_minfree_read(struct cgroup *cgrp, struct cftype *cft,
+				       struct seq_file *m)
+{
+	struct mem_cgroup *mem = mem_cgroup_from_cont(cgrp);
+	size_t minfree[MEM_CGROUP_LMK_LEVELS];
+	unsigned long flags;
+	int i, n;
+
+	spin_lock_irqsave(&mem->pressure_lock, flags);
+	n = mem->lmk_minfree_size;
+	memcpy(minfree, mem->lmk_minfree, sizeof(minfree));
+	spin_unlock_irqrestore(&mem->pressure_lock, flags);
+
+	for (i = 0; i < n; i++)
+		seq_printf(m, "%s%zu", i ? "," : "", minfree[i]);
+	seq_putc(m, '\n');
+	return 0;
+}
+
+/*
+ * Takes a comma separated list of up to MEM_CGROUP_LMK_LEVELS free page
+ * counts in ascending order, matching the adj levels of the
+ * lowmemorykiller. An empty string removes the group's own levels.
+ */
+static int mem_cgroup_lmk_minfree_write(struct cgroup *cgrp,
+					struct cftype *cft, const char *buffer)
+{
+	struct mem_cgroup *mem = mem_cgroup_from_cont(cgrp);
+	size_t minfree[MEM_CGROUP_LMK_LEVELS];
+	char *buf, *p, *tok;
+	unsigned long val, flags;
+	int n = 0, old, ret = 0;
+
+	buf = kstrdup(strstrip((char *)buffer), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	p = buf;
+	while ((tok = strsep(&p, ",")) != NULL) {
+		if (!*tok)
+			continue;
+		if (n == MEM_CGROUP_LMK_LEVELS) {
+			ret = -EINVAL;
+			goto out;
+		}
+		ret = kstrtoul(tok, 0, &val);
+		if (ret)
+			goto out;
+		if (n && val < minfree[n - 1]) {
+			ret = -EINVAL;
+			goto out;
+		}
+		minfree[n++] = val;
+	}
+
+	spin_lock_irqsave(&mem->pressure_lock, flags);
+	old = mem->lmk_minfree_size;
+	memcpy(mem->lmk_minfree, minfree, n * sizeof(*minfree));
+	mem->lmk_minfree_size = n;
+	spin_unlock_irqrestore(&mem->pressure_lock, flags);
+
+	if (!old && n)
+		atomic_inc(&mem_cgroup_lmk_groups);
+	else if (old && !n)
+		atomic_dec(&mem_cgroup_lmk_groups);
+out:
+	kfree(buf);
+	return ret;
+}
+
 static int mem_cgroup_oom_control_read(struct cgroup *cgrp,
 	struct cftype *cft,  struct cgroup_map_cb *cb)
 {
@@ -4731,6 +5113,17 @@ static struct cftype mem_cgroup_files[] = {
 		.unregister_event = mem_cgroup_oom_unregister_event,
 		.private = MEMFILE_PRIVATE(_OOM_TYPE, OOM_CONTROL),
 	},
+	{
+		.name = "pressure_level",
+		.read_seq_string = mem_cgroup_pressure_read,
+		.register_event = mem_cgroup_pressure_register_event,
+		.unregister_event = mem_cgroup_pressure_unregister_event,
+	},
+	{
+		.name = "lmk_minfree",
+		.read_seq_string = mem_cgroup_lmk_minfree_read,
+		.write_string = mem_cgroup_lmk_minfree_write,
+	},
 #ifdef CONFIG_NUMA
 	{
 		.name = "numa_stat",
@@ -4995,6 +5388,8 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	mem->last_scanned_child = 0;
 	mem->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&mem->oom_notify);
+	spin_lock_init(&mem->pressure_lock);
+	INIT_LIST_HEAD(&mem->pressure_notify);
 
 	if (parent)
 		mem->swappiness = get_swappiness(parent);
@@ -5021,6 +5416,8 @@ static void mem_cgroup_destroy(struct cgroup_subsys *ss,
 {
 	struct mem_cgroup *mem = mem_cgroup_from_cont(cont);
 
+	if (mem->lmk_minfree_size)
+		atomic_dec(&mem_cgroup_lmk_groups);
 	mem_cgroup_put(mem);
 }
 
@@ -37,24 +37,23 @@
 #include <trace/events/writeback.h>
 
 /*
- * After a CPU has dirtied this many pages, balance_dirty_pages_ratelimited
- * will look to see if it needs to force writeback or throttling.
+ * Sleep at most 200ms at a time in balance_dirty_pages().
  */
-static long ratelimit_pages = 32;
+#define MAX_PAUSE		max(HZ/5, 1)
 
 /*
- * When balance_dirty_pages decides that the caller needs to perform some
- * non-background writeback, this is how many pages it will attempt to write.
- * It should be somewhat larger than dirtied pages to ensure that reasonably
- * large amounts of I/O are submitted.
+ * Estimate write bandwidth at 200ms intervals.
  */
-static inline long sync_writeback_pages(unsigned long dirtied)
-{
-	if (dirtied < ratelimit_pages)
-		dirtied = ratelimit_pages;
+#define BANDWIDTH_INTERVAL	max(HZ/5, 1)
 
-	return dirtied + dirtied / 2;
-}
+#define RATELIMIT_CALC_SHIFT	10
+
+/*
+ * After a CPU has dirtied this many pages, balance_dirty_pages_ratelimited
+ * will look to see if it needs to start dirty throttling, whatever the
+ * throttling state of the tasks that did the dirtying.
+ */
+static long ratelimit_pages = 32;
 
 /* The following parameters are exported via /proc/sys/vm */
 
@@ -219,6 +218,7 @@ int dirty_bytes_handler(struct ctl_table *table, int write,
  */
 static inline void __bdi_writeout_inc(struct backing_dev_info *bdi)
 {
+	__inc_bdi_stat(bdi, BDI_WRITTEN);
 	__prop_inc_percpu_max(&vm_completions, &bdi->completions,
 			      bdi->max_prop_frac);
 }
@@ -468,37 +468,240 @@ unsigned long bdi_dirty_limit(struct backing_dev_info *bdi, unsigned long dirty)
 	return bdi_dirty;
 }
 
+/*
+ * Write bandwidth of @bdi over the last @elapsed jiffies, smoothed over
+ * a ~3s period and then once more against sudden spikes.
+ */
+static void bdi_update_write_bandwidth(struct backing_dev_info *bdi,
+				       unsigned long elapsed,
+				       unsigned long written)
+{
+	const unsigned long period = roundup_pow_of_two(3 * HZ);
+	unsigned long avg = bdi->avg_write_bandwidth;
+	unsigned long old = bdi->write_bandwidth;
+	u64 bw;
+
+	/*
+	 * bw = written * HZ / elapsed
+	 *
+	 *                   bw * elapsed + write_bandwidth * (period - elapsed)
+	 * write_bandwidth = ---------------------------------------------------
+	 *                                          period
+	 */
+	bw = written - bdi->written_stamp;
+	bw *= HZ;
+	if (unlikely(elapsed > period)) {
+		do_div(bw, elapsed);
+		avg = bw;
+		goto out;
+	}
+	bw += (u64)bdi->write_bandwidth * (period - elapsed);
+	bw >>= ilog2(period);
+
+	/*
+	 * Only follow a change of the estimate once it has lasted a while
+	 */
+	if (avg > old && old >= (unsigned long)bw)
+		avg -= (avg - old) >> 3;
+
+	if (avg < old && old <= (unsigned long)bw)
+		avg += (old - avg) >> 3;
+
+out:
+	bdi->write_bandwidth = bw;
+	bdi->avg_write_bandwidth = avg;
+}
+
+/*
+ * Rate at which each task dirtying pages on @bdi is let go at the
+ * setpoint.  The tasks were let dirty at task_ratelimit each and
+ * together dirtied at dirty_rate, so N of them dirty at
+ *
+ *	dirty_rate = N * task_ratelimit
+ *
+ * and dirty exactly as fast as the bdi writes at
+ *
+ *	write_bw / N = task_ratelimit * write_bw / dirty_rate
+ *
+ * which is the balanced rate, whatever the position ratio.
+ * dirty_ratelimit moves half way towards it each time.
+ */
+static void bdi_update_dirty_ratelimit(struct backing_dev_info *bdi,
+				       unsigned long pos_ratio,
+				       unsigned long elapsed,
+				       unsigned long dirtied)
+{
+	unsigned long dirty_rate;
+	unsigned long task_ratelimit;
+	unsigned long balanced_ratelimit;
+
+	dirty_rate = div_u64((u64)(dirtied - bdi->dirtied_stamp) * HZ, elapsed);
+
+	task_ratelimit = ((u64)bdi->dirty_ratelimit * pos_ratio) >>
+							RATELIMIT_CALC_SHIFT;
+	task_ratelimit++;	/* lets a tiny ratelimit ramp up again */
+
+	balanced_ratelimit = div_u64((u64)task_ratelimit *
+				     bdi->avg_write_bandwidth, dirty_rate | 1);
+
+	bdi->dirty_ratelimit = max((bdi->dirty_ratelimit +
+				    balanced_ratelimit) / 2, 1UL);
+}
+
+static DEFINE_SPINLOCK(bdi_bandwidth_lock);
+
+static void __bdi_update_bandwidth(struct backing_dev_info *bdi,
+				   unsigned long pos_ratio,
+				   unsigned long start_time)
+{
+	unsigned long now = jiffies;
+	unsigned long elapsed;
+	unsigned long dirtied;
+	unsigned long written;
+
+	if (now - bdi->bw_time_stamp < BANDWIDTH_INTERVAL)
+		return;
+
+	spin_lock(&bdi_bandwidth_lock);
+	elapsed = now - bdi->bw_time_stamp;
+	if (elapsed < BANDWIDTH_INTERVAL)
+		goto unlock;
+
+	dirtied = percpu_counter_read(&bdi->bdi_stat[BDI_DIRTIED]);
+	written = percpu_counter_read(&bdi->bdi_stat[BDI_WRITTEN]);
+
+	/*
+	 * Skip quiet periods when the disk bandwidth is under-utilized,
+	 * at least 1s of idle time between two flusher runs.
+	 */
+	if (elapsed > HZ && time_before(bdi->bw_time_stamp, start_time))
+		goto snapshot;
+
+	bdi_update_write_bandwidth(bdi, elapsed, written);
+	if (pos_ratio)
+		bdi_update_dirty_ratelimit(bdi, pos_ratio, elapsed, dirtied);
+
+snapshot:
+	bdi->dirtied_stamp = dirtied;
+	bdi->written_stamp = written;
+	bdi->bw_time_stamp = now;
+unlock:
+	spin_unlock(&bdi_bandwidth_lock);
+}
+
+/**
+ * bdi_update_bandwidth - update the write bandwidth estimate of a bdi
+ * @bdi: the backing device
+ * @start_time: when the writeback that is calling in started
+ *
+ * Called by the flusher threads as they write, at most every 200ms have
+ * an effect.  Throttled tasks update the estimate too.
+ */
+void bdi_update_bandwidth(struct backing_dev_info *bdi,
+			  unsigned long start_time)
+{
+	__bdi_update_bandwidth(bdi, 0, start_time);
+}
+
+/*
+ * Position of the dirty pages between the freerun ceiling and the hard
+ * limit as a throttle ratio, 1 << RATELIMIT_CALC_SHIFT being 1.  It is
+ * 2 at the freerun ceiling, 1 at the setpoint half way up and 0 at the
+ * limit.  The same line scaled down to bdi_thresh is applied to the
+ * dirty pages of the bdi, but only down to 1/8 there: the bdi limit is
+ * a soft one.
+ */
+static unsigned long bdi_position_ratio(unsigned long freerun,
+					unsigned long limit,
+					unsigned long dirty,
+					unsigned long bdi_thresh,
+					unsigned long bdi_dirty)
+{
+	unsigned long bdi_freerun;
+	u64 pos_ratio;
+	u64 bdi_ratio;
+
+	if (unlikely(dirty >= limit))
+		return 0;
+
+	pos_ratio = div_u64((u64)(limit - dirty) << (RATELIMIT_CALC_SHIFT + 1),
+			    limit - freerun + 1);
+
+	bdi_freerun = div_u64((u64)freerun * bdi_thresh, limit);
+	if (bdi_dirty >= bdi_thresh) {
+		bdi_ratio = 1 << (RATELIMIT_CALC_SHIFT - 3);
+	} else {
+		bdi_ratio = div_u64((u64)(bdi_thresh - bdi_dirty) <<
+				    (RATELIMIT_CALC_SHIFT + 1),
+				    bdi_thresh - bdi_freerun + 1);
+		bdi_ratio = clamp_t(u64, bdi_ratio,
+				    1 << (RATELIMIT_CALC_SHIFT - 3),
+				    2 << RATELIMIT_CALC_SHIFT);
+	}
+
+	return (pos_ratio * bdi_ratio) >> RATELIMIT_CALC_SHIFT;
+}
+
+/*
+ * Pages a task may dirty before looking at the dirty state again, the
+ * square root of the distance to the limit so that many tasks cannot
+ * together overshoot it.
+ */
+static unsigned long dirty_poll_interval(unsigned long dirty,
+					 unsigned long thresh)
+{
+	if (thresh > dirty)
+		return 1UL << (ilog2(thresh - dirty) >> 1);
+
+	return 1;
+}
+
+/*
+ * Pages to dirty at @task_ratelimit for a pause of about MAX_PAUSE / 2.
+ */
+static unsigned long task_dirty_pause(unsigned long task_ratelimit,
+				      unsigned long dirty,
+				      unsigned long thresh)
+{
+	unsigned long pages = task_ratelimit * (MAX_PAUSE / 2) / HZ;
+
+	pages = min(pages, dirty_poll_interval(dirty, thresh));
+	return max(pages, 1UL);
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
- * data.  It looks at the number of dirty pages in the machine and will force
- * the caller to perform writeback if the system is over `vm_dirty_ratio'.
- * If we're over `background_thresh' then the writeback threads are woken to
- * perform some writeout.
+ * data.  It looks at the number of dirty pages in the machine and throttles
+ * the caller to the rate at which its bdi writes back, by making it sleep.
+ * All the writeback itself is done by the flusher threads: the dirtier only
+ * starts background writeback when there is none going on.
+ *
+ * @pages_dirtied is how many pages the caller dirtied since it last paused,
+ * it sleeps for as long as dirtying them takes at its current ratelimit.
  */
 static void balance_dirty_pages(struct address_space *mapping,
-				unsigned long write_chunk)
+				unsigned long pages_dirtied)
 {
-	long nr_reclaimable, bdi_nr_reclaimable;
-	long nr_writeback, bdi_nr_writeback;
+	unsigned long nr_reclaimable, bdi_nr_reclaimable;
+	unsigned long nr_dirty, bdi_dirty;
 	unsigned long background_thresh;
 	unsigned long dirty_thresh;
 	unsigned long bdi_thresh;
-	unsigned long pages_written = 0;
-	unsigned long pause = 1;
+	unsigned long freerun;
+	unsigned long pos_ratio;
+	unsigned long task_ratelimit;
+	long period;
+	long pause;
 	bool dirty_exceeded = false;
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned long start_time = jiffies;
 
 	for (;;) {
-		struct writeback_control wbc = {
-			.sync_mode	= WB_SYNC_NONE,
-			.older_than_this = NULL,
-			.nr_to_write	= write_chunk,
-			.range_cyclic	= 1,
-		};
+		unsigned long now = jiffies;
 
 		nr_reclaimable = global_page_state(NR_FILE_DIRTY) +
 					global_page_state(NR_UNSTABLE_NFS);
-		nr_writeback = global_page_state(NR_WRITEBACK);
+		nr_dirty = nr_reclaimable + global_page_state(NR_WRITEBACK);
 
 		global_dirty_limits(&background_thresh, &dirty_thresh);
 
@@ -507,9 +710,17 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 * catch-up. This avoids (excessively) small writeouts
 		 * when the bdi limits are ramping up.
 		 */
-		if (nr_reclaimable + nr_writeback <=
-				(background_thresh + dirty_thresh) / 2)
+		freerun = (background_thresh + dirty_thresh) / 2;
+		if (nr_dirty <= freerun) {
+			current->dirty_paused_when = now;
+			current->nr_dirtied = 0;
+			current->nr_dirtied_pause =
+				dirty_poll_interval(nr_dirty, dirty_thresh);
 			break;
+		}
+
+		if (unlikely(!writeback_in_progress(bdi)))
+			bdi_start_background_writeback(bdi);
 
 		bdi_thresh = bdi_dirty_limit(bdi, dirty_thresh);
 		bdi_thresh = task_dirty_limit(current, bdi_thresh);
@@ -526,10 +737,12 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 */
 		if (bdi_thresh < 2*bdi_stat_error(bdi)) {
 			bdi_nr_reclaimable = bdi_stat_sum(bdi, BDI_RECLAIMABLE);
-			bdi_nr_writeback = bdi_stat_sum(bdi, BDI_WRITEBACK);
+			bdi_dirty = bdi_nr_reclaimable +
+				    bdi_stat_sum(bdi, BDI_WRITEBACK);
 		} else {
 			bdi_nr_reclaimable = bdi_stat(bdi, BDI_RECLAIMABLE);
-			bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
+			bdi_dirty = bdi_nr_reclaimable +
+				    bdi_stat(bdi, BDI_WRITEBACK);
 		}
 
 		/*
@@ -538,44 +751,71 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 * bdi or process from holding back light ones; The latter is
 		 * the last resort safeguard.
 		 */
-		dirty_exceeded =
-			(bdi_nr_reclaimable + bdi_nr_writeback > bdi_thresh)
-			|| (nr_reclaimable + nr_writeback > dirty_thresh);
-
-		if (!dirty_exceeded)
-			break;
-
-		if (!bdi->dirty_exceeded)
+		dirty_exceeded = (bdi_dirty > bdi_thresh) ||
+				 (nr_dirty > dirty_thresh);
+		if (dirty_exceeded && !bdi->dirty_exceeded)
 			bdi->dirty_exceeded = 1;
 
-		/* Note: nr_reclaimable denotes nr_dirty + nr_unstable.
-		 * Unstable writes are a feature of certain networked
-		 * filesystems (i.e. NFS) in which data may have been
-		 * written to the server's write cache, but has not yet
-		 * been flushed to permanent storage.
-		 * Only move pages to writeback if this bdi is over its
-		 * threshold otherwise wait until the disk writes catch
-		 * up.
-		 */
-		trace_wbc_balance_dirty_start(&wbc, bdi);
-		if (bdi_nr_reclaimable > bdi_thresh) {
-			writeback_inodes_wb(&bdi->wb, &wbc);
-			pages_written += write_chunk - wbc.nr_to_write;
-			trace_wbc_balance_dirty_written(&wbc, bdi);
-			if (pages_written >= write_chunk)
-				break;		/* We've done our duty */
+		pos_ratio = bdi_position_ratio(freerun, dirty_thresh, nr_dirty,
+					       bdi_thresh, bdi_dirty);
+		__bdi_update_bandwidth(bdi, pos_ratio, start_time);
+
+		task_ratelimit = ((u64)bdi->dirty_ratelimit * pos_ratio) >>
+							RATELIMIT_CALC_SHIFT;
+		if (unlikely(task_ratelimit == 0)) {
+			/* Over the hard limit, wait for the flusher */
+			period = MAX_PAUSE;
+			pause = MAX_PAUSE;
+		} else {
+			period = HZ * pages_dirtied / task_ratelimit;
+			pause = period;
+			if (current->dirty_paused_when)
+				pause -= now - current->dirty_paused_when;
+			/*
+			 * The time since the last pause counts towards this
+			 * one.  Up to 1s of it is carried over to the next
+			 * periods, a task that did not dirty for longer
+			 * just starts again.
+			 */
+			if (pause <= 0) {
+				if (pause < -HZ) {
+					current->dirty_paused_when = now;
+					current->nr_dirtied = 0;
+				} else if (period) {
+					current->dirty_paused_when += period;
+					current->nr_dirtied = 0;
+				} else if (current->nr_dirtied_pause <=
+					   pages_dirtied)
+					current->nr_dirtied_pause +=
+						pages_dirtied;
+				break;
+			}
+			if (unlikely(pause > MAX_PAUSE)) {
+				/* for an occasional drop of task_ratelimit */
+				now += min(pause - MAX_PAUSE, (long)MAX_PAUSE);
+				pause = MAX_PAUSE;
+			}
 		}
-		trace_wbc_balance_dirty_wait(&wbc, bdi);
-		__set_current_state(TASK_UNINTERRUPTIBLE);
+
+		trace_balance_dirty_pages(bdi, dirty_thresh, nr_dirty,
+					  bdi_thresh, bdi_dirty,
+					  task_ratelimit, pages_dirtied,
+					  pause);
+		__set_current_state(TASK_KILLABLE);
 		io_schedule_timeout(pause);
 
-		/*
-		 * Increase the delay for each loop, up to our previous
-		 * default of taking a 100ms nap.
-		 */
-		pause <<= 1;
-		if (pause > HZ / 10)
-			pause = HZ / 10;
+		current->dirty_paused_when = now + pause;
+		current->nr_dirtied = 0;
+		current->nr_dirtied_pause = task_dirty_pause(task_ratelimit,
+							     nr_dirty,
+							     dirty_thresh);
+
+		/* The pages are paid for, unless over the hard limit */
+		if (task_ratelimit)
+			break;
+
+		if (fatal_signal_pending(current))
+			break;
 	}
 
 	if (!dirty_exceeded && bdi->dirty_exceeded)
@@ -592,8 +832,10 @@ static void balance_dirty_pages(struct address_space *mapping,
 	 * In normal mode, we start background writeout at the lower
 	 * background_thresh, to keep the amount of dirty memory low.
 	 */
-	if ((laptop_mode && pages_written) ||
-	    (!laptop_mode && (nr_reclaimable > background_thresh)))
+	if (laptop_mode)
+		return;
+
+	if (nr_reclaimable > background_thresh)
 		bdi_start_background_writeback(bdi);
 }
 
@@ -618,36 +860,46 @@ static DEFINE_PER_CPU(unsigned long, bdp_ratelimits) = 0;
  * which was newly dirtied.  The function will periodically check the system's
  * dirty state and will initiate writeback if needed.
  *
- * On really big machines, get_writeback_state is expensive, so try to avoid
- * calling it too often (ratelimiting).  But once we're over the dirty memory
- * limit we decrease the ratelimiting by a lot, to prevent individual processes
- * from overshooting the limit by (ratelimit_pages) each.
+ * Each task is let dirty current->nr_dirtied_pause pages between two
+ * checks, set by balance_dirty_pages() to cover about one pause at its
+ * ratelimit.  Once we're over the dirty memory limit the checks become
+ * much more frequent, to prevent individual processes from overshooting it.
  */
 void balance_dirty_pages_ratelimited_nr(struct address_space *mapping,
 					unsigned long nr_pages_dirtied)
 {
-	unsigned long ratelimit;
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	int ratelimit;
 	unsigned long *p;
 
-	ratelimit = ratelimit_pages;
-	if (mapping->backing_dev_info->dirty_exceeded)
-		ratelimit = 8;
+	if (!bdi_cap_account_dirty(bdi))
+		return;
+
+	ratelimit = current->nr_dirtied_pause;
+	if (bdi->dirty_exceeded)
+		ratelimit = min(ratelimit, 32 >> (PAGE_SHIFT - 10));
 
+	current->nr_dirtied += nr_pages_dirtied;
+
+	preempt_disable();
 	/*
-	 * Check the rate limiting. Also, we do not want to throttle real-time
-	 * tasks in balance_dirty_pages(). Period.
+	 * Catch the tasks that exit, or otherwise stop dirtying, before
+	 * reaching their own nr_dirtied_pause.
 	 */
-	preempt_disable();
-	p =  &__get_cpu_var(bdp_ratelimits);
-	*p += nr_pages_dirtied;
-	if (unlikely(*p >= ratelimit)) {
-		ratelimit = sync_writeback_pages(*p);
+	p = &__get_cpu_var(bdp_ratelimits);
+	if (unlikely(current->nr_dirtied >= ratelimit))
 		*p = 0;
-		preempt_enable();
-		balance_dirty_pages(mapping, ratelimit);
-		return;
+	else {
+		*p += nr_pages_dirtied;
+		if (unlikely(*p >= ratelimit_pages)) {
+			*p = 0;
+			ratelimit = 0;
+		}
 	}
 	preempt_enable();
+
+	if (unlikely(current->nr_dirtied >= ratelimit))
+		balance_dirty_pages(mapping, current->nr_dirtied);
 }
 EXPORT_SYMBOL(balance_dirty_pages_ratelimited_nr);
 
@@ -744,11 +996,9 @@ void laptop_sync_completion(void)
  * dirtying in parallel, we cannot go more than 3% (1/32) over the dirty memory
  * thresholds before writeback cuts in.
  *
- * But the limit should not be set too high.  Because it also controls the
- * amount of memory which the balance_dirty_pages() caller has to write back.
- * If this is too large then the caller will block on the IO queue all the
- * time.  So limit it to four megabytes - the balance_dirty_pages() caller
- * will write six megabyte chunks, max.
+ * Tasks are normally throttled on their own count of dirtied pages, this
+ * per-CPU limit only catches the many short-lived ones that exit before
+ * reaching theirs.  Four megabytes is plenty for that.
  */
 
 void writeback_set_ratelimit(void)
@@ -1127,6 +1377,7 @@ void account_page_dirtied(struct page *page, struct address_space *mapping)
 		__inc_zone_page_state(page, NR_FILE_DIRTY);
 		__inc_zone_page_state(page, NR_DIRTIED);
 		__inc_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
+		__inc_bdi_stat(mapping->backing_dev_info, BDI_DIRTIED);
 		task_dirty_inc(current);
 		task_io_account_write(PAGE_CACHE_SIZE);
 	}
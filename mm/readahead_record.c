@@ -0,0 +1,426 @@
+/*
+ * mm/readahead_record.c
+ *
+ * Record the page cache misses of a window of time, typically boot,
+ * and replay them as readahead early in the next boot.  Readahead only
+ * follows the access pattern of each file; the many small random reads
+ * of starting up a system give it nothing to follow.
+ *
+ * See Documentation/vm/readahead-record.txt
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/path.h>
+#include <linux/hash.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/readahead_record.h>
+#include <asm/uaccess.h>
+
+#define RA_RECORD_HASH_BITS	8
+
+/*
+ * A file seen in the window.  It is pinned while recording so that its
+ * path can be printed, and only its name is kept once recording stops.
+ */
+struct ra_record_file {
+	struct hlist_node	hash;
+	struct list_head	list;
+	struct address_space	*mapping;
+	struct path		path;
+	char			*name;
+};
+
+/* A run of pages that missed, contiguous misses of a file are merged */
+struct ra_record {
+	struct ra_record_file	*file;
+	pgoff_t			index;
+	unsigned long		nr;
+};
+
+int readahead_recording;
+
+/*
+ * ra_record_lock serializes recording, ra_record_mutex the lifetime of
+ * the trace.  Runs are published by ra_nr_records, readers only hold
+ * the mutex.
+ */
+static DEFINE_SPINLOCK(ra_record_lock);
+static DEFINE_MUTEX(ra_record_mutex);
+static struct hlist_head ra_record_hash[1 << RA_RECORD_HASH_BITS];
+static LIST_HEAD(ra_record_files);
+static struct ra_record *ra_records;
+static unsigned int ra_nr_records;
+static unsigned int ra_size;
+
+static u32 ra_max_records = 16384;
+static u32 ra_dropped;
+static int ra_record_at_boot;
+
+static int __init readahead_record_setup(char *str)
+{
+	ra_record_at_boot = 1;
+	return 1;
+}
+__setup("readahead_record", readahead_record_setup);
+
+static struct ra_record_file *ra_record_find(struct address_space *mapping)
+{
+	struct ra_record_file *file;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(file, node, &ra_record_hash[hash_ptr(mapping,
+				RA_RECORD_HASH_BITS)], hash)
+		if (file->mapping == mapping)
+			return file;
+	return NULL;
+}
+
+/*
+ * Called from readahead and page faults for @nr pages from @index of
+ * @filp that were not in the page cache.
+ */
+void __readahead_record(struct file *filp, pgoff_t index, unsigned long nr)
+{
+	struct address_space *mapping = filp->f_mapping;
+	struct ra_record_file *file, *new = NULL;
+	struct ra_record *last;
+
+again:
+	spin_lock(&ra_record_lock);
+	if (!readahead_recording)
+		goto out;
+
+	file = ra_record_find(mapping);
+	if (!file) {
+		if (!new) {
+			spin_unlock(&ra_record_lock);
+			new = kmalloc(sizeof(*new), GFP_NOFS);
+			if (!new)
+				return;
+			new->mapping = mapping;
+			new->path = filp->f_path;
+			new->name = NULL;
+			path_get(&new->path);
+			goto again;
+		}
+		hlist_add_head(&new->hash, &ra_record_hash[hash_ptr(mapping,
+					RA_RECORD_HASH_BITS)]);
+		list_add_tail(&new->list, &ra_record_files);
+		file = new;
+		new = NULL;
+	}
+
+	last = ra_nr_records ? &ra_records[ra_nr_records - 1] : NULL;
+	if (last && last->file == file && last->index + last->nr == index) {
+		last->nr += nr;
+	} else if (ra_nr_records < ra_size) {
+		last = &ra_records[ra_nr_records];
+		last->file = file;
+		last->index = index;
+		last->nr = nr;
+		/* pairs with smp_rmb() in ra_trace_nr() */
+		smp_wmb();
+		ra_nr_records++;
+	} else
+		ra_dropped++;
+out:
+	spin_unlock(&ra_record_lock);
+	if (new) {
+		path_put(&new->path);
+		kfree(new);
+	}
+}
+
+/* Drop the trace, recording must be stopped.  Needs ra_record_mutex */
+static void ra_record_clear(void)
+{
+	struct ra_record_file *file, *tmp;
+	int i;
+
+	list_for_each_entry_safe(file, tmp, &ra_record_files, list) {
+		if (file->path.mnt)
+			path_put(&file->path);
+		kfree(file->name);
+		kfree(file);
+	}
+	INIT_LIST_HEAD(&ra_record_files);
+	for (i = 0; i < ARRAY_SIZE(ra_record_hash); i++)
+		INIT_HLIST_HEAD(&ra_record_hash[i]);
+	vfree(ra_records);
+	ra_records = NULL;
+	ra_nr_records = 0;
+}
+
+static int ra_record_start(void)
+{
+	struct ra_record *records;
+
+	if (readahead_recording)
+		return 0;
+	ra_record_clear();
+	if (!ra_max_records ||
+	    ra_max_records > ULONG_MAX / sizeof(*records))
+		return -EINVAL;
+	records = vmalloc(ra_max_records * sizeof(*records));
+	if (!records)
+		return -ENOMEM;
+
+	spin_lock(&ra_record_lock);
+	ra_records = records;
+	ra_size = ra_max_records;
+	ra_dropped = 0;
+	readahead_recording = 1;
+	spin_unlock(&ra_record_lock);
+	return 0;
+}
+
+/*
+ * Stop recording and replace the pinned paths of the trace by their
+ * names, so the trace does not keep filesystems from being unmounted.
+ * Needs ra_record_mutex.
+ */
+static void ra_record_stop(void)
+{
+	struct ra_record_file *file;
+	char *buf, *name;
+
+	spin_lock(&ra_record_lock);
+	readahead_recording = 0;
+	spin_unlock(&ra_record_lock);
+
+	buf = (char *) __get_free_page(GFP_KERNEL);
+
+	/* Nothing is added to the list once recording is off */
+	list_for_each_entry(file, &ra_record_files, list) {
+		if (!file->path.mnt)
+			continue;
+		if (buf) {
+			name = d_path(&file->path, buf, PAGE_SIZE);
+			if (!IS_ERR(name))
+				file->name = kstrdup(name, GFP_KERNEL);
+		}
+		path_put(&file->path);
+		file->path.mnt = NULL;
+		file->path.dentry = NULL;
+	}
+
+	free_page((unsigned long) buf);
+}
+
+static int ra_enable_get(void *data, u64 *val)
+{
+	*val = readahead_recording;
+	return 0;
+}
+
+static int ra_enable_set(void *data, u64 val)
+{
+	int err = 0;
+
+	mutex_lock(&ra_record_mutex);
+	if (val)
+		err = ra_record_start();
+	else
+		ra_record_stop();
+	mutex_unlock(&ra_record_mutex);
+	return err;
+}
+DEFINE_SIMPLE_ATTRIBUTE(ra_enable_fops, ra_enable_get, ra_enable_set,
+			"%llu\n");
+
+/*
+ * The trace is one run per line, "<index> <pages> <path>", in the order
+ * the misses happened.  It can be read while recording.
+ */
+static unsigned int ra_trace_nr(void)
+{
+	unsigned int nr = ACCESS_ONCE(ra_nr_records);
+
+	/* pairs with smp_wmb() in __readahead_record() */
+	smp_rmb();
+	return nr;
+}
+
+static void *ra_trace_start(struct seq_file *m, loff_t *pos)
+{
+	mutex_lock(&ra_record_mutex);
+	if (*pos >= ra_trace_nr())
+		return NULL;
+	return &ra_records[*pos];
+}
+
+static void *ra_trace_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	if (*pos >= ra_trace_nr())
+		return NULL;
+	return &ra_records[*pos];
+}
+
+static void ra_trace_stop(struct seq_file *m, void *v)
+{
+	mutex_unlock(&ra_record_mutex);
+}
+
+static int ra_trace_show(struct seq_file *m, void *v)
+{
+	struct ra_record *r = v;
+	struct ra_record_file *file = r->file;
+
+	/* The path could not be resolved when recording stopped */
+	if (!file->path.mnt && !file->name)
+		return 0;
+
+	seq_printf(m, "%lu %lu ", r->index, ACCESS_ONCE(r->nr));
+	if (file->path.mnt)
+		seq_path(m, &file->path, "\n\\");
+	else
+		seq_escape(m, file->name, "\n\\");
+	seq_putc(m, '\n');
+	return 0;
+}
+
+static const struct seq_operations ra_trace_seq_ops = {
+	.start	= ra_trace_start,
+	.next	= ra_trace_next,
+	.stop	= ra_trace_stop,
+	.show	= ra_trace_show,
+};
+
+static int ra_trace_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &ra_trace_seq_ops);
+}
+
+static const struct file_operations ra_trace_fops = {
+	.open		= ra_trace_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+/* Undo the octal escapes of seq_path() in place */
+static void ra_unescape(char *s)
+{
+	char *d = s;
+
+	while (*s) {
+		if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' &&
+		    s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+			*d++ = ((s[1] - '0') << 6) | ((s[2] - '0') << 3) |
+			       (s[3] - '0');
+			s += 4;
+		} else
+			*d++ = *s++;
+	}
+	*d = '\0';
+}
+
+/*
+ * Lines written to "replay", in the format of the trace, are started as
+ * readahead of the file.  Only whole lines are consumed, writers like
+ * cat(1) write the rest again.
+ */
+static ssize_t ra_replay_write(struct file *file, const char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	struct file *filp = NULL;
+	char *buf, *line, *next, *end, *path = NULL;
+	size_t len = min_t(size_t, count, PAGE_SIZE - 1);
+	ssize_t ret;
+
+	buf = (char *) __get_free_page(GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	ret = -EFAULT;
+	if (copy_from_user(buf, ubuf, len))
+		goto out;
+	buf[len] = '\0';
+
+	end = strrchr(buf, '\n');
+	if (end) {
+		*end = '\0';
+		ret = end - buf + 1;
+	} else if (len == count) {
+		ret = len;
+	} else {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (line = buf; line; line = next) {
+		unsigned long index, nr;
+		int n;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		if (!*line || *line == '#')
+			continue;
+		if (sscanf(line, "%lu %lu %n", &index, &nr, &n) != 2 ||
+		    !line[n]) {
+			ret = -EINVAL;
+			break;
+		}
+		ra_unescape(line + n);
+
+		if (!path || strcmp(path, line + n)) {
+			if (filp)
+				filp_close(filp, NULL);
+			path = line + n;
+			filp = filp_open(path, O_RDONLY | O_LARGEFILE, 0);
+			if (IS_ERR(filp))
+				filp = NULL;
+		}
+		if (filp)
+			force_page_cache_readahead(filp->f_mapping, filp,
+						   index, nr);
+	}
+	if (filp)
+		filp_close(filp, NULL);
+out:
+	free_page((unsigned long) buf);
+	return ret;
+}
+
+static const struct file_operations ra_replay_fops = {
+	.write		= ra_replay_write,
+	.llseek		= noop_llseek,
+};
+
+static int __init readahead_record_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("readahead_record", NULL);
+	if (dir) {
+		debugfs_create_file("enable", S_IRUSR | S_IWUSR, dir, NULL,
+				    &ra_enable_fops);
+		debugfs_create_u32("max_records", S_IRUSR | S_IWUSR, dir,
+				   &ra_max_records);
+		debugfs_create_u32("dropped", S_IRUSR, dir, &ra_dropped);
+		debugfs_create_file("trace", S_IRUSR, dir, NULL,
+				    &ra_trace_fops);
+		debugfs_create_file("replay", S_IWUSR, dir, NULL,
+				    &ra_replay_fops);
+	}
+
+	if (ra_record_at_boot) {
+		mutex_lock(&ra_record_mutex);
+		if (ra_record_start())
+			printk(KERN_WARNING "readahead_record: no memory for "
+			       "%u records\n", ra_max_records);
+		mutex_unlock(&ra_record_mutex);
+	}
+	return 0;
+}
+module_init(readahead_record_init)
@@ -2208,6 +2208,120 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/*
+ * Bulk freeing: objects that belong to the current cpu slab are chained
+ * onto the per cpu freelist directly with interrupts disabled, so the
+ * per cpu area is looked up and the tid is advanced only once for the
+ * whole run instead of doing one cmpxchg per object.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	struct kmem_cache_cpu *c;
+	struct page *page;
+	size_t i;
+
+	local_irq_disable();
+	c = __this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void **object = p[i];
+
+		slab_free_hook(s, object);
+		page = virt_to_head_page(object);
+
+		if (likely(page == c->page)) {
+			set_freepointer(s, object, c->freelist);
+			c->freelist = object;
+			stat(s, FREE_FASTPATH);
+		} else {
+			/*
+			 * Invalidate any fastpath operation that was
+			 * interrupted before we give up the cpu.
+			 */
+			c->tid = next_tid(c->tid);
+			local_irq_enable();
+			__slab_free(s, page, object, _RET_IP_);
+			local_irq_disable();
+			c = __this_cpu_ptr(s->cpu_slab);
+		}
+
+		trace_kmem_cache_free(_RET_IP_, object);
+	}
+
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
+/*
+ * Bulk allocation: take as many objects as possible from the per cpu
+ * freelist with interrupts disabled and fall back to __slab_alloc()
+ * once it runs empty. Returns the number of objects allocated, which
+ * is either @size or 0.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	size_t i, j;
+
+	if (slab_pre_alloc_hook(s, flags))
+		return 0;
+
+	local_irq_disable();
+	c = __this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void **object = c->freelist;
+
+		if (unlikely(!object)) {
+			/*
+			 * The slowpath may enable interrupts and move us to
+			 * another cpu, so invalidate any interrupted
+			 * fastpath operation first.
+			 */
+			c->tid = next_tid(c->tid);
+			local_irq_enable();
+
+			object = __slab_alloc(s, flags, NUMA_NO_NODE,
+					      _RET_IP_, c);
+			if (unlikely(!object))
+				goto error;
+
+			p[i] = object;
+			local_irq_disable();
+			c = __this_cpu_ptr(s->cpu_slab);
+			continue;
+		}
+
+		c->freelist = get_freepointer(s, object);
+		p[i] = object;
+		stat(s, ALLOC_FASTPATH);
+	}
+
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+
+	for (j = 0; j < size; j++) {
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[j], 0, s->objsize);
+
+		slab_post_alloc_hook(s, flags, p[j]);
+		trace_kmem_cache_alloc(_RET_IP_, p[j], s->objsize, s->size,
+				       flags);
+	}
+
+	return size;
+
+error:
+	for (j = 0; j < i; j++)
+		slab_post_alloc_hook(s, flags, p[j]);
+
+	kmem_cache_free_bulk(s, i, p);
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
 /*
  * Object placement in a slab is made very easy because we always start at
  * offset 0. If we tune the size of the object to the alignment then we can
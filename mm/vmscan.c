@@ -1977,6 +1977,13 @@ restart:
 	if (inactive_anon_is_low(zone, sc))
 		shrink_active_list(SWAP_CLUSTER_MAX, zone, sc, priority, 0);
 
+	/*
+	 * Feed the reclaim efficiency of this pass to the pressure level
+	 * of the target group, or of the root group for global reclaim.
+	 */
+	mem_cgroup_account_reclaim(sc->mem_cgroup,
+				   sc->nr_scanned - nr_scanned, nr_reclaimed);
+
 	/* reclaim/compaction might need reclaim to continue */
 	if (should_continue_reclaim(zone, nr_reclaimed,
 					sc->nr_scanned - nr_scanned, sc))
@@ -2103,6 +2110,7 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 		sc->nr_scanned = 0;
 		if (!priority)
 			disable_swap_token(sc->mem_cgroup);
+		mem_cgroup_reclaim_priority(sc->mem_cgroup, priority);
 		shrink_zones(priority, zonelist, sc);
 		/*
 		 * Don't shrink slabs when reclaiming memory from
@@ -2431,6 +2439,8 @@ loop_again:
 		if (!priority)
 			disable_swap_token(NULL);
 
+		mem_cgroup_reclaim_priority(NULL, priority);
+
 		all_zones_ok = 1;
 		balanced = 0;
 
@@ -462,6 +462,47 @@ void consume_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(consume_skb);
 
+#define SKB_FREE_BULK	16
+
+/**
+ *	__kfree_skb_list - free a list of unreferenced skbuffs
+ *	@skb: first buffer of a list linked through ->next
+ *	@location: caller reported to the kfree_skb tracepoint
+ *
+ *	Free every buffer of the list like __kfree_skb() does. The heads of
+ *	buffers that were not fast-cloned are returned to their cache in
+ *	batches, which is cheaper than freeing them one at a time.
+ */
+void __kfree_skb_list(struct sk_buff *skb, void *location)
+{
+	void *heads[SKB_FREE_BULK];
+	size_t n = 0;
+
+	while (skb) {
+		struct sk_buff *next = skb->next;
+
+		WARN_ON(atomic_read(&skb->users));
+		trace_kfree_skb(skb, location);
+		skb_release_all(skb);
+
+		if (skb->fclone == SKB_FCLONE_UNAVAILABLE) {
+			heads[n++] = skb;
+			if (n == SKB_FREE_BULK) {
+				kmem_cache_free_bulk(skbuff_head_cache, n,
+						     heads);
+				n = 0;
+			}
+		} else
+			kfree_skbmem(skb);
+
+		skb = next;
+	}
+
+	if (n)
+		kmem_cache_free_bulk(skbuff_head_cache, n, heads);
+}
+EXPORT_SYMBOL(__kfree_skb_list);
+
 /**
  *	skb_recycle_check - check if skb can be reused for receive
  *	@skb: buffer
@@ -0,0 +1,195 @@
+/*
+ *
+ * futex-hash.c
+ *
+ * hash: Benchmark for the hashing of futexes in the kernel
+ *
+ * Threads do FUTEX_WAIT calls that fail at once, because the value of
+ * the futex never matches.  Each call still takes the lock of the hash
+ * bucket of the futex, so with many threads the throughput shows how
+ * much unrelated futexes contend on the same buckets.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <linux/futex.h>
+
+#ifndef PR_FUTEX_HASH
+#define PR_FUTEX_HASH			78
+# define PR_FUTEX_HASH_SET_SLOTS	1
+#endif
+
+static unsigned int nthreads;
+static unsigned int nfutexes = 1024;
+static unsigned int nsecs = 10;
+static unsigned int private_slots;
+static bool fshared;
+
+static volatile int done;
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct worker {
+	pthread_t thread;
+	unsigned int *futex;
+	unsigned long long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: online CPUs)"),
+	OPT_UINTEGER('f', "futexes", &nfutexes,
+		     "Specify number of futexes per thread"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime in seconds"),
+	OPT_BOOLEAN('s', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_UINTEGER('p', "private-hash", &private_slots,
+		     "Give the process a private futex hash of this many buckets"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	int op = FUTEX_WAIT | (fshared ? 0 : FUTEX_PRIVATE_FLAG);
+	unsigned long long ops = 0;
+	unsigned int i;
+
+	/* Start all the workers together */
+	pthread_mutex_lock(&start_lock);
+	pthread_mutex_unlock(&start_lock);
+
+	while (!done) {
+		for (i = 0; i < nfutexes; i++, ops++) {
+			/* The value is 0, the wait fails with EAGAIN */
+			if (syscall(SYS_futex, &w->futex[i], op, 1234,
+				    NULL, NULL, 0) == 0 ||
+			    (errno != EAGAIN && errno != EWOULDBLOCK)) {
+				fprintf(stderr, "futex: %s\n", strerror(errno));
+				exit(1);
+			}
+		}
+	}
+
+	w->ops = ops;
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long total = 0;
+	double secs;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_hash_usage, 0);
+	if (argc)
+		usage_with_options(bench_futex_hash_usage, options);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nthreads || !nfutexes || !nsecs)
+		usage_with_options(bench_futex_hash_usage, options);
+
+	/* Only possible while the process is single threaded */
+	if (private_slots &&
+	    prctl(PR_FUTEX_HASH, PR_FUTEX_HASH_SET_SLOTS, private_slots,
+		  0, 0)) {
+		fprintf(stderr, "prctl(PR_FUTEX_HASH): %s\n", strerror(errno));
+		return 1;
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		die("calloc");
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_lock(&start_lock);
+	for (i = 0; i < nthreads; i++) {
+		workers[i].futex = calloc(nfutexes, sizeof(unsigned int));
+		if (!workers[i].futex)
+			die("calloc");
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			die("pthread_create");
+	}
+
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(workers[i].thread, NULL))
+			die("pthread_join");
+		total += workers[i].ops;
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads operating on %u %s futexes each",
+		       nthreads, nfutexes, fshared ? "shared" : "private");
+		if (private_slots)
+			printf(", private hash of %u buckets", private_slots);
+		printf("\n\n");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+
+		for (i = 0; i < nthreads; i++)
+			printf(" [thread %3u] %14llu ops/sec\n", i,
+			       (unsigned long long) (workers[i].ops / secs));
+		printf("\n %14llu ops/sec in total\n",
+		       (unsigned long long) (total / secs));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", (unsigned long long) (total / secs));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	for (i = 0; i < nthreads; i++)
+		free(workers[i].futex);
+	free(workers);
+
+	return 0;
+}